@@ -0,0 +1,75 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Arena allocator for objects that are freed all at once.
+
+#include "common.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE 8192
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct ArenaChunk {
+	struct ArenaChunk *next;
+	max_align_t data[];
+};
+
+Arena *new_arena(void) {
+	return calloc(1, sizeof(Arena));
+}
+
+void free_arena(Arena *a) {
+	if (!a)
+		return;
+	for (struct ArenaChunk *c = a->chunks, *next; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (size > (size_t)(a->end - a->ptr)) {
+		// The rest of the current chunk is abandoned.
+		size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		struct ArenaChunk *c = malloc(sizeof(struct ArenaChunk) + chunk_size);
+		if (!c)
+			error("out of memory");
+		c->next = a->chunks;
+		a->chunks = c;
+		a->ptr = (char *)c->data;
+		a->end = a->ptr + chunk_size;
+	}
+	void *p = a->ptr;
+	a->ptr += size;
+	memset(p, 0, size);
+	return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+	char *p = arena_alloc(a, n + 1);
+	memcpy(p, s, n);
+	return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+	return arena_strndup(a, s, strlen(s));
+}
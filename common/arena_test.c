@@ -0,0 +1,51 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+static void test_arena_alloc(void) {
+	Arena *a = new_arena();
+	for (int i = 1; i < 100; i++) {
+		uint8_t *p = arena_alloc(a, i * 7);
+		assert((uintptr_t)p % _Alignof(max_align_t) == 0);
+		for (int j = 0; j < i * 7; j++)
+			assert(p[j] == 0);
+		memset(p, 0xff, i * 7);
+	}
+	// Larger than a chunk
+	uint8_t *big = arena_alloc(a, 100000);
+	assert(big[0] == 0 && big[99999] == 0);
+	free_arena(a);
+}
+
+static void test_arena_strdup(void) {
+	Arena *a = new_arena();
+	assert(!strcmp(arena_strndup(a, "foobar", 3), "foo"));
+	assert(!strcmp(arena_strdup(a, ""), ""));
+	assert(!strcmp(arena_strdup(a, "baz"), "baz"));
+	free_arena(a);
+}
+
+void arena_test(void) {
+	test_arena_alloc();
+	test_arena_strdup();
+}
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdnoreturn.h>
 #include <time.h>
+#include "libdri.h"
 
 #define VERSION "0.4.1"
 
@@ -29,6 +30,10 @@ static inline uint32_t le16(const uint8_t *p) {
 	return p[0] | p[1] << 8;
 }
 
+static inline uint32_t le32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
 // util.c
 
 void init(int *argc, char ***argv);
@@ -36,6 +41,17 @@ char *strndup_(const char *s, size_t n);
 noreturn void error(char *fmt, ...);
 FILE *checked_fopen(const char *path_utf8, const char *mode);
 int checked_open(const char *path_utf8, int oflag);
+void checked_rename(const char *from_utf8, const char *to_utf8);
+
+// Read-only view of a whole file. `data` is readable (and zero-filled past
+// the end of the file) up to the next 256-byte boundary.
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	bool mapped;  // true if data is an mmap()ed region
+} MappedFile;
+
+MappedFile *map_file(const char *path_utf8);
 
 char *basename_utf8(const char *path);
 char *dirname_utf8(const char *path);
@@ -59,10 +75,20 @@ enum encoding {
 #define utf2sjis(s) utf2sjis_sub((s), -1)
 char *sjis2utf_sub(const char *str, int substitution_char);
 char *utf2sjis_sub(const char *str, int substitution_char);
+// Same as sjis2utf_sub(str, 0xfffd), but also stores in *invalid the position
+// of the first substituted character in the result, or NULL if there is none.
+char *sjis2utf_checked(const char *str, const char **invalid);
 char *msx2sjis_msg(const char *str, int len);
 char *msx2sjis_data(const char *str);
 char *utf2msx_msg(const char *str, int *out_len);
 char *utf2msx_data(const char *str);
+// Convert the UTF-8 string [str, str + len) into dst, which must have room for
+// len bytes, and return the number of bytes written. With `compact`, full-width
+// characters that have a half-width form are written in it (see compact_sjis()).
+// If a character cannot be converted, its position is stored in *invalid and
+// -1 is returned.
+int utf2sjis_to(const char *str, int len, uint8_t *dst, bool compact, const char **invalid);
+int utf2msx_msg_to(const char *str, int len, uint8_t *dst, const char **invalid);
 uint8_t compact_sjis(uint8_t c1, uint8_t c2);
 uint16_t expand_sjis(uint8_t c);
 bool is_valid_sjis(uint8_t c1, uint8_t c2);
@@ -102,6 +128,7 @@ typedef struct {
 Vector *new_vec(void);
 void vec_push(Vector *v, void *e);
 void vec_set(Vector *v, int index, void *e);
+void free_vec(Vector *v);
 
 void stack_push(Vector *stack, uintptr_t n);
 void stack_pop(Vector *stack);
@@ -134,25 +161,132 @@ typedef struct {
 
 HashMap *new_hash(HashFunc hash, HashKeyCompare compare);
 HashMap *new_string_hash(void);
+void free_hash(HashMap *m);
 void hash_put(HashMap *m, const void *key, const void *val);
 void *hash_get(HashMap *m, const void *key);
 HashItem *hash_iterate(HashMap *m, HashItem *item);
 
-// dri.c
+// arena.c
 
-#define DRI_MAX_VOLUME 26
+// Objects allocated from an arena are freed together by free_arena().
+typedef struct {
+	struct ArenaChunk *chunks;
+	char *ptr;
+	char *end;
+} Arena;
+
+Arena *new_arena(void);
+void free_arena(Arena *a);
+// Returns zero-filled memory suitably aligned for any type.
+void *arena_alloc(Arena *a, size_t size);
+char *arena_strndup(Arena *a, const char *s, size_t n);
+char *arena_strdup(Arena *a, const char *s);
+
+// intern.c
+
+// Interned strings (atoms) are equal iff they are the same pointer.
+typedef struct Interner Interner;
+
+// A child interner returns the atoms of `parent` for the strings interned
+// there. The parent must not be modified while the child is in use by
+// another thread.
+Interner *new_interner(const Interner *parent);
+void free_interner(Interner *in);
+const char *intern(Interner *in, const char *s, size_t len);
+// Returns the atom for the string if it has been interned, or NULL.
+const char *intern_lookup(const Interner *in, const char *s, size_t len);
+uint32_t atom_hash(const char *atom);
+// A HashMap whose keys are atoms.
+HashMap *new_atom_hash(void);
+
+// json.c
+
+typedef enum {
+	JSON_NULL,
+	JSON_FALSE,
+	JSON_TRUE,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+} JsonType;
+
+typedef struct Json {
+	JsonType type;
+	double number;
+	const char *string;  // UTF-8
+	struct Json *child;  // first element or member of an array or object
+	struct Json *next;   // next element or member
+	const char *key;     // member name, if this is an object member
+} Json;
+
+// Parses a JSON text. All objects are allocated from `arena`. Returns NULL if
+// the text is not valid JSON.
+Json *json_parse(Arena *arena, const char *text, size_t len);
+// Returns the member `key` of an object, or NULL if obj is not an object or
+// does not have the member.
+Json *json_get(const Json *obj, const char *key);
+
+// lz.c
+
+// Compresses `len` bytes of `src`. Returns a malloc'ed buffer and stores its
+// size in *out_len.
+uint8_t *lz_compress(const uint8_t *src, size_t len, size_t *out_len);
+// Decompresses data made by lz_compress() into `dst`. Returns false if the
+// data is corrupted or does not decompress to exactly `dst_len` bytes.
+bool lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len);
+
+// parallel.c
+
+// Calls func(ctx, i) for each i in [0, n), using up to `jobs` threads. The
+// order in which func is called is unspecified.
+void parallel_for(int n, int jobs, void (*func)(void *ctx, int i), void *ctx);
+// Returns the number of online processors (1 if threads are not available).
+int nr_cpus(void);
+
+// Calls func(ctx, i) for i = 0, 1, ..., n - 1 in order on a background
+// thread, staying at most `window` items ahead of pipeline_wait().
+typedef struct Pipeline Pipeline;
+Pipeline *pipeline_start(int n, int window, void (*func)(void *ctx, int i), void *ctx);
+// Waits until func(ctx, i) has returned. `i` must not decrease between calls.
+void pipeline_wait(Pipeline *p, int i);
+// Stops processing further items and frees the pipeline.
+void pipeline_finish(Pipeline *p);
+
+// fileio.c
+
+// Same as open(2), but takes a UTF-8 path and always opens in binary mode.
+int open_utf8(const char *path_utf8, int oflag, int mode);
+// Returns 0 on success or an errno value.
+int try_map_file(const char *path_utf8, MappedFile **mf);
+void unmap_file(MappedFile *mf);
+
+// dri.c
 
 typedef struct {
 	int id;      // 1-based
-	const uint8_t *data;
+	const uint8_t *data;   // NULL until dri_entry_data() for dri_read_index() entries
 	int size;
 	uint32_t volume_bits;  // (1 << k) is set if the entry is present in the k-th volume
+	const char *path;      // volume the data was first found in (not owned)
+	int offset;            // offset of data in that volume
 } DriEntry;
 
+// Returns the whole image of the given volume, whose length is stored in *size.
+uint8_t *dri_build_image(Vector *entries, int volume, size_t *size);
 void dri_write(Vector *entries, int volume, FILE *fp);
 Vector *dri_read(Vector *entries, const char *path);
-int dri_volume_number(const char *fname);
-bool dri_filename(char *adisk_name, int volume);
+// Same as dri_read(), but takes an already mapped volume. The returned entries
+// point into `image` and `path`, so they must outlive them.
+Vector *dri_read_mapped(Vector *entries, const char *path, const MappedFile *image);
+// Reads only the pointer and link sectors. Entry data are loaded on demand by
+// dri_entry_data(), which reads from `path`, so it must outlive the entries.
+Vector *dri_read_index(Vector *entries, const char *path);
+const uint8_t *dri_entry_data(DriEntry *e);
+// Replaces the data of entry `id` in the volume file in place. Only the
+// affected sectors are rewritten unless the entry grows, in which case the
+// rest of the volume is moved back.
+void dri_update_entry(const char *path, int id, const uint8_t *data, int size);
 
 // ag00.c
 
@@ -260,7 +394,7 @@ static inline SysVer get_sysver(GameId id) {
 
 GameId game_id_from_name(const char *name);
 const char *game_id_to_name(GameId id);
-uint32_t calc_crc32(const char* fname);
+uint32_t calc_crc32(const uint8_t *data, size_t len);
 GameId detect_game_id(uint32_t adisk_crc, uint32_t bdisk_crc);
 
 // opcodes
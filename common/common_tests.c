@@ -16,10 +16,20 @@
  *
 */
 
+void arena_test(void);
+void intern_test(void);
+void json_test(void);
+void libdri_test(void);
+void lz_test(void);
 void sjisutf_test(void);
 void util_test(void);
 
 int main() {
+	arena_test();
+	intern_test();
+	json_test();
+	libdri_test();
+	lz_test();
 	sjisutf_test();
 	util_test();
 }
@@ -37,6 +37,11 @@ void vec_push(Vector *v, void *e) {
 	v->data[v->len++] = e;
 }
 
+void free_vec(Vector *v) {
+	free(v->data);
+	free(v);
+}
+
 void vec_set(Vector *v, int index, void *e) {
 	while (v->len <= index)
 		vec_push(v, NULL);
@@ -87,6 +92,11 @@ HashMap *new_hash(HashFunc hash, HashKeyCompare compare) {
 	return m;
 }
 
+void free_hash(HashMap *m) {
+	free(m->table);
+	free(m);
+}
+
 static uint32_t string_hash(const char *p) {
 	// FNV hash
 	uint32_t r = 2166136261;
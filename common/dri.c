@@ -17,177 +17,126 @@
 */
 
 #include "common.h"
-#include <ctype.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#ifndef _O_BINARY
-#define _O_BINARY 0
-#endif
 
-static void write_ptr(int size, int *sector, FILE *fp) {
-	*sector += (size + 0xff) >> 8;
-	int n = *sector + 1;
-	fputc(n & 0xff, fp);
-	fputc(n >> 8 & 0xff, fp);
+static noreturn void dri_error(const char *path, DriStatus st) {
+	if (st == DRI_ERR_IO)
+		error("%s: %s", path, strerror(dri_errno()));
+	error("%s: %s", path, dri_strerror(st));
 }
 
-static void pad(FILE *fp) {
-	// Align to next sector boundary
-	long pos = ftell(fp);
-	for (; pos & 0xff; pos++)
-		fputc(0, fp);
-}
-
-static void write_entry(DriEntry *entry, FILE *fp) {
-	fwrite(entry->data, entry->size, 1, fp);
-}
-
-void dri_write(Vector *entries, int volume, FILE *fp) {
-	int sector = 0;
-
-	int ptr_count = 0;
-	for (int i = 0; i < entries->len; i++) {
-		DriEntry *entry = entries->data[i];
-		if (entry && entry->volume_bits & 1 << volume)
-			ptr_count++;
-	}
-
-	write_ptr((ptr_count + 3) * 2, &sector, fp);
-	write_ptr(entries->len * 2 + 1, &sector, fp);
+uint8_t *dri_build_image(Vector *entries, int volume, size_t *psize) {
+	DriSlice *slices = calloc(entries->len + 1, sizeof(DriSlice));
 	for (int i = 0; i < entries->len; i++) {
 		DriEntry *entry = entries->data[i];
-		if (entry && entry->volume_bits & 1 << volume)
-			write_ptr(entry->size, &sector, fp);
+		if (entry)
+			slices[i] = (DriSlice){ entry->data, entry->size, entry->volume_bits };
 	}
-	fputc(0, fp);
-	fputc(0, fp);
-	pad(fp);
+	uint8_t *image;
+	DriStatus st = dri_layout_volume(slices, entries->len, volume, &image, psize);
+	if (st != DRI_OK)
+		error("volume %c: %s", 'A' + volume - 1, dri_strerror(st));
+	free(slices);
+	return image;
+}
 
-	uint16_t link[DRI_MAX_VOLUME + 1];
-	memset(link, 0, sizeof(link));
-	for (int i = 0; i < entries->len; i++) {
-		DriEntry *entry = entries->data[i];
-		int vol = 0;
-		if (entry) {
-			for (int j = 1; j <= DRI_MAX_VOLUME; j++) {
-				if (entry->volume_bits & 1 << j) {
-					link[j]++;
-					if (!vol || j == volume)
-						vol = j;
-				}
-			}
-		}
-		fputc(vol, fp);
-		fputc(link[vol], fp);
-	}
-	fputc(0x1a, fp);  // EOF
-	pad(fp);
+void dri_write(Vector *entries, int volume, FILE *fp) {
+	size_t size;
+	uint8_t *image = dri_build_image(entries, volume, &size);
+	if (fwrite(image, size, 1, fp) != 1)
+		error("dri_write: %s", strerror(errno));
+	free(image);
+}
 
-	for (int i = 0; i < entries->len; i++) {
-		DriEntry *entry = entries->data[i];
-		if (!entry || !(entry->volume_bits & 1 << volume))
-			continue;
-		write_entry(entry, fp);
-		pad(fp);
+typedef struct {
+	Vector *entries;
+	int volume;
+	const uint8_t *image;  // NULL if only the index is read
+	const char *path;
+} ReadContext;
+
+static DriStatus add_entry(void *ctx, int id, size_t offset, size_t size) {
+	ReadContext *rc = ctx;
+	Vector *entries = rc->entries;
+	DriEntry *e = id <= entries->len ? entries->data[id - 1] : NULL;
+	if (e) {
+		if (e->size != size)
+			error("duplicate entry with different content: %d", id);
+		if (rc->image && e->data && memcmp(e->data, rc->image + offset, size))
+			error("duplicate entry with different content: %d", id);
+		e->volume_bits |= 1 << rc->volume;
+	} else {
+		e = calloc(1, sizeof(DriEntry));
+		e->id = id;
+		e->volume_bits = 1 << rc->volume;
+		e->size = size;
+		if (rc->image)
+			e->data = rc->image + offset;
+		e->path = rc->path;
+		e->offset = offset;
+		vec_set(entries, id - 1, e);
 	}
+	return DRI_OK;
 }
 
-static inline uint8_t *dri_sector(uint8_t *dri, int size, int index) {
-	uint8_t *p = dri + index * 2;
-	int offset = (p[0] << 8 | p[1] << 16) - 256;
-	if (offset > size)
-		error("sector offset out of range: %d", offset);
-	return dri + offset;
+static int volume_from_path(const char *path) {
+	char *basename = basename_utf8(path);
+	int volume = dri_volume_number(basename);
+	if (!volume)
+		error("cannot determine volume number from filename: %s", basename);
+	return volume;
 }
 
-static void dri_read_entries(Vector *entries, int volume, uint8_t *data, int dri_size) {
-	uint8_t *link_sector = dri_sector(data, dri_size, 0);
-	uint8_t *link_sector_end = dri_sector(data, dri_size, 1);
-
-	for (uint8_t *link = link_sector; link < link_sector_end; link += 2) {
-		uint8_t vol_nr = link[0];
-		uint8_t ptr_nr = link[1];
-		if (vol_nr != volume)
-			continue;
-		uint8_t *entry_ptr = dri_sector(data, dri_size, ptr_nr);
-		int entry_size = dri_sector(data, dri_size, ptr_nr + 1) - entry_ptr;
-		if (entry_ptr + entry_size > data + dri_size)
-			error("entry size exceeds end of dri file");
-		int id = (link - link_sector) / 2 + 1;
-		DriEntry *e = id <= entries->len ? entries->data[id - 1] : NULL;
-		if (e) {
-			if (e->size != entry_size || memcmp(e->data, entry_ptr, entry_size))
-				error("duplicate entry with different content: %d", id);
-			e->volume_bits |= 1 << volume;
-		} else {
-			e = calloc(1, sizeof(DriEntry));
-			e->id = id;
-			e->volume_bits = 1 << volume;
-			e->data = entry_ptr;
-			e->size = entry_size;
-			vec_set(entries, id - 1, e);
-		}
-	}
+Vector *dri_read(Vector *entries, const char *path) {
+	return dri_read_mapped(entries, path, map_file(path));
 }
 
-Vector *dri_read(Vector *entries, const char *path) {
+Vector *dri_read_mapped(Vector *entries, const char *path, const MappedFile *image) {
 	if (!entries)
 		entries = new_vec();
 
-	int fd = checked_open(path, O_RDONLY | _O_BINARY);
-
-	struct stat sbuf;
-	if (fstat(fd, &sbuf) < 0)
-		error("%s: %s", path, strerror(errno));
+	ReadContext rc = { entries, volume_from_path(path), image->data, path };
+	size_t size = (image->size + 0xff) & ~0xff;
+	DriStatus st = dri_scan_volume(image->data, size, size, rc.volume, add_entry, &rc);
+	if (st != DRI_OK)
+		dri_error(path, st);
 
-	size_t size = (sbuf.st_size + 0xff) & ~0xff;
-	uint8_t *p = calloc(1, size);
-	size_t bytes = 0;
-	while (bytes < sbuf.st_size) {
-		ssize_t ret = read(fd, p + bytes, sbuf.st_size - bytes);
-		if (ret <= 0)
-			error("%s: %s", path, strerror(errno));
-		bytes += ret;
-	}
-	close(fd);
+	return entries;
+}
 
-	char *basename = basename_utf8(path);
-	int volume = dri_volume_number(basename);
-	if (!volume)
-		error("cannot determine volume number from filename: %s", basename);
-	dri_read_entries(entries, volume, p, size);
+Vector *dri_read_index(Vector *entries, const char *path) {
+	if (!entries)
+		entries = new_vec();
 
+	ReadContext rc = { entries, volume_from_path(path), NULL, path };
+	uint8_t *header;
+	size_t header_size, size;
+	DriStatus st = dri_load_header(path, &header, &header_size, &size);
+	if (st == DRI_OK)
+		st = dri_scan_volume(header, header_size, size, rc.volume, add_entry, &rc);
+	if (st != DRI_OK)
+		dri_error(path, st);
+	free(header);
 	return entries;
 }
 
-int dri_volume_number(const char *fname) {
-	// ADISK.DAT, BDISK.DAT, ...
-	char *ext = strrchr(fname, '.');
-	if (ext && !strcasecmp(ext, ".DAT") && isalpha(fname[0]))
-		return toupper(fname[0]) - 'A' + 1;
-	// DISK-A, DISK-B, ...
-	char *hyphen = strrchr(fname, '-');
-	if (hyphen && isalpha(hyphen[1]) && hyphen[2] == '\0')
-		return toupper(hyphen[1]) - 'A' + 1;
-	return 0;
+const uint8_t *dri_entry_data(DriEntry *e) {
+	if (!e->data && e->path) {
+		uint8_t *buf;
+		DriStatus st = dri_load_range(e->path, e->offset, e->size, &buf);
+		if (st != DRI_OK)
+			dri_error(e->path, st);
+		e->data = buf;
+	}
+	return e->data;
 }
 
-bool dri_filename(char *adisk_name, int volume) {
-	// A*.DAT
-	char *ext = strrchr(adisk_name, '.');
-	if (ext && !strcasecmp(ext, ".DAT") && toupper(adisk_name[0]) == 'A') {
-		adisk_name[0] += volume - 1;
-		return true;
-	}
-	// *-A
-	char *hyphen = strrchr(adisk_name, '-');
-	if (hyphen && toupper(hyphen[1]) == 'A' && hyphen[2] == '\0') {
-		hyphen[1] += volume - 1;
-		return true;
-	}
-	return false;
+void dri_update_entry(const char *path, int id, const uint8_t *data, int size) {
+	DriStatus st = dri_patch_volume(path, volume_from_path(path), id, data, size);
+	if (st == DRI_ERR_NO_ENTRY)
+		error("%s: no entry for index %d", path, id);
+	if (st != DRI_OK)
+		dri_error(path, st);
 }
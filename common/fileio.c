@@ -0,0 +1,115 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// File access that reports errors instead of exiting. This file is also
+// linked into libdri, so it must not call error().
+
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifndef _O_BINARY
+#define _O_BINARY 0
+#endif
+
+int open_utf8(const char *path_utf8, int oflag, int mode) {
+#ifdef _WIN32
+	wchar_t wpath[PATH_MAX + 1];
+	if (!MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path_utf8, -1, wpath, PATH_MAX + 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return _wopen(wpath, oflag | _O_BINARY, mode);
+#else
+	return open(path_utf8, oflag | _O_BINARY, mode);
+#endif
+}
+
+int try_map_file(const char *path_utf8, MappedFile **pmf) {
+	int fd = open_utf8(path_utf8, O_RDONLY, 0);
+	if (fd == -1)
+		return errno;
+
+	struct stat sbuf;
+	if (fstat(fd, &sbuf) < 0) {
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	MappedFile *mf = calloc(1, sizeof(MappedFile));
+	if (!mf) {
+		close(fd);
+		return ENOMEM;
+	}
+	mf->size = sbuf.st_size;
+#ifndef _WIN32
+	// The tail of the last page is zero-filled by the kernel, so the mapping
+	// is readable up to the next sector boundary just like the copy below.
+	if (mf->size > 0) {
+		void *p = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			close(fd);
+			mf->data = p;
+			mf->mapped = true;
+			*pmf = mf;
+			return 0;
+		}
+	}
+#endif
+
+	// Fall back to reading the whole file into a zero-padded buffer.
+	uint8_t *p = calloc(1, ((mf->size + 0xff) & ~0xff) + 1);
+	int err = p ? 0 : ENOMEM;
+	size_t bytes = 0;
+	while (!err && bytes < mf->size) {
+		ssize_t ret = read(fd, p + bytes, mf->size - bytes);
+		if (ret < 0)
+			err = errno;
+		else if (ret == 0)
+			err = EIO;  // the file was truncated
+		else
+			bytes += ret;
+	}
+	close(fd);
+	if (err) {
+		free(p);
+		free(mf);
+		return err;
+	}
+	mf->data = p;
+	*pmf = mf;
+	return 0;
+}
+
+void unmap_file(MappedFile *mf) {
+#ifndef _WIN32
+	if (mf->mapped)
+		munmap((void *)mf->data, mf->size);
+	else
+#endif
+		free((void *)mf->data);
+	free(mf);
+}
@@ -190,7 +190,7 @@ const char *game_id_to_name(GameId id) {
 	return NULL;
 }
 
-uint32_t calc_crc32(const char* fname) {
+uint32_t calc_crc32(const uint8_t *data, size_t len) {
 	static uint32_t table[256];
 	if (!table[1]) {
 		for (int i = 0; i < 256; i++) {
@@ -206,10 +206,9 @@ uint32_t calc_crc32(const char* fname) {
 		}
 	}
 
-	FILE *fp = checked_fopen(fname, "rb");
 	uint32_t crc = 0;
-	for (int i = 0; i < 256; i++) {
-		int d = fgetc(fp);
+	for (size_t i = 0; i < len; i++) {
+		int d = data[i];
 		uint32_t c = ~crc;
 		c = table[(c ^ d) & 0xff] ^ (c >> 8);
 		crc = ~c;
@@ -0,0 +1,142 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// String interning. Each distinct string is stored once in an interner, so
+// interned strings ("atoms") can be compared by pointer. The hash value of an
+// atom is stored in front of it.
+
+#include "common.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERNER_INIT_SIZE 64
+
+typedef struct {
+	uint32_t hash;
+	uint32_t len;
+	char str[];
+} Atom;
+
+#define TO_ATOM(s) ((const Atom *)((s) - offsetof(Atom, str)))
+
+struct Interner {
+	const Interner *parent;
+	Arena *arena;
+	const Atom **table;
+	uint32_t size;
+	uint32_t count;
+};
+
+static uint32_t hash_bytes(const char *s, size_t len) {
+	// FNV hash
+	uint32_t r = 2166136261;
+	for (size_t i = 0; i < len; i++) {
+		r ^= s[i];
+		r *= 16777619;
+	}
+	return r;
+}
+
+Interner *new_interner(const Interner *parent) {
+	Interner *in = calloc(1, sizeof(Interner));
+	in->parent = parent;
+	in->arena = new_arena();
+	in->size = INTERNER_INIT_SIZE;
+	in->table = calloc(in->size, sizeof(Atom *));
+	return in;
+}
+
+void free_interner(Interner *in) {
+	if (!in)
+		return;
+	free_arena(in->arena);
+	free(in->table);
+	free(in);
+}
+
+static const Atom *find(const Interner *in, const char *s, size_t len, uint32_t hash) {
+	for (uint32_t h = hash & (in->size - 1); in->table[h]; h = (h + 1) & (in->size - 1)) {
+		const Atom *a = in->table[h];
+		if (a->hash == hash && a->len == len && !memcmp(a->str, s, len))
+			return a;
+	}
+	return NULL;
+}
+
+static void insert(Interner *in, const Atom *a) {
+	if (in->count * 4 >= in->size * 3) {
+		const Atom **old = in->table;
+		uint32_t old_size = in->size;
+		in->size *= 2;
+		in->table = calloc(in->size, sizeof(Atom *));
+		for (uint32_t i = 0; i < old_size; i++) {
+			if (!old[i])
+				continue;
+			uint32_t h = old[i]->hash & (in->size - 1);
+			while (in->table[h])
+				h = (h + 1) & (in->size - 1);
+			in->table[h] = old[i];
+		}
+		free(old);
+	}
+	uint32_t h = a->hash & (in->size - 1);
+	while (in->table[h])
+		h = (h + 1) & (in->size - 1);
+	in->table[h] = a;
+	in->count++;
+}
+
+const char *intern(Interner *in, const char *s, size_t len) {
+	uint32_t hash = hash_bytes(s, len);
+	const Atom *a = find(in, s, len, hash);
+	if (a)
+		return a->str;
+	a = in->parent ? find(in->parent, s, len, hash) : NULL;
+	if (!a) {
+		Atom *na = arena_alloc(in->arena, sizeof(Atom) + len + 1);
+		na->hash = hash;
+		na->len = len;
+		memcpy(na->str, s, len);
+		a = na;
+	}
+	// Atoms of the parent are also registered here, so that later lookups
+	// need only one probe sequence.
+	insert(in, a);
+	return a->str;
+}
+
+const char *intern_lookup(const Interner *in, const char *s, size_t len) {
+	uint32_t hash = hash_bytes(s, len);
+	const Atom *a = find(in, s, len, hash);
+	if (!a && in->parent)
+		a = find(in->parent, s, len, hash);
+	return a ? a->str : NULL;
+}
+
+uint32_t atom_hash(const char *atom) {
+	return TO_ATOM(atom)->hash;
+}
+
+static int atom_compare(const void *a1, const void *a2) {
+	return a1 != a2;
+}
+
+HashMap *new_atom_hash(void) {
+	return new_hash((HashFunc)atom_hash, atom_compare);
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void test_intern(void) {
+	Interner *in = new_interner(NULL);
+	const char *foo = intern(in, "foobar", 3);
+	assert(!strcmp(foo, "foo"));
+	assert(intern(in, "foo", 3) == foo);
+	assert(intern(in, "fo", 2) != foo);
+	assert(intern_lookup(in, "foo", 3) == foo);
+	assert(!intern_lookup(in, "bar", 3));
+
+	// Enough atoms to grow the table
+	char buf[16];
+	const char *atoms[1000];
+	for (int i = 0; i < 1000; i++) {
+		sprintf(buf, "a%d", i);
+		atoms[i] = intern(in, buf, strlen(buf));
+	}
+	for (int i = 0; i < 1000; i++) {
+		sprintf(buf, "a%d", i);
+		assert(intern_lookup(in, buf, strlen(buf)) == atoms[i]);
+	}
+
+	HashMap *map = new_atom_hash();
+	hash_put(map, foo, (void *)1);
+	assert(hash_get(map, foo) == (void *)1);
+	assert(!hash_get(map, atoms[0]));
+
+	Interner *child = new_interner(in);
+	assert(intern(child, "foo", 3) == foo);
+	const char *baz = intern(child, "baz", 3);
+	assert(!intern_lookup(in, "baz", 3));
+	assert(intern_lookup(child, "baz", 3) == baz);
+	free_interner(child);
+	free_interner(in);
+}
+
+void intern_test(void) {
+	test_intern();
+}
@@ -0,0 +1,238 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// A small JSON parser, used by the query server (sys3c --server).
+
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Arena *arena;
+	const char *p;
+	const char *end;
+} Parser;
+
+static Json *parse_value(Parser *ps, int depth);
+
+static void skip_ws(Parser *ps) {
+	while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r'))
+		ps->p++;
+}
+
+static bool consume_char(Parser *ps, char c) {
+	skip_ws(ps);
+	if (ps->p < ps->end && *ps->p == c) {
+		ps->p++;
+		return true;
+	}
+	return false;
+}
+
+static bool consume_literal(Parser *ps, const char *lit) {
+	size_t len = strlen(lit);
+	if (ps->end - ps->p < len || memcmp(ps->p, lit, len))
+		return false;
+	ps->p += len;
+	return true;
+}
+
+static int hex4(Parser *ps) {
+	if (ps->end - ps->p < 4)
+		return -1;
+	int v = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = *ps->p++;
+		v <<= 4;
+		if ('0' <= c && c <= '9')
+			v |= c - '0';
+		else if ('a' <= c && c <= 'f')
+			v |= c - 'a' + 10;
+		else if ('A' <= c && c <= 'F')
+			v |= c - 'A' + 10;
+		else
+			return -1;
+	}
+	return v;
+}
+
+static char *put_utf8(char *d, int c) {
+	if (c < 0x80) {
+		*d++ = c;
+	} else if (c < 0x800) {
+		*d++ = 0xc0 | c >> 6;
+		*d++ = 0x80 | (c & 0x3f);
+	} else if (c < 0x10000) {
+		*d++ = 0xe0 | c >> 12;
+		*d++ = 0x80 | (c >> 6 & 0x3f);
+		*d++ = 0x80 | (c & 0x3f);
+	} else {
+		*d++ = 0xf0 | c >> 18;
+		*d++ = 0x80 | (c >> 12 & 0x3f);
+		*d++ = 0x80 | (c >> 6 & 0x3f);
+		*d++ = 0x80 | (c & 0x3f);
+	}
+	return d;
+}
+
+// Parses a string after the opening quote. Escapes never make the string
+// longer, so the result fits in the length of the raw string.
+static const char *parse_string(Parser *ps) {
+	const char *top = ps->p;
+	while (ps->p < ps->end && *ps->p != '"') {
+		if (*ps->p == '\\')
+			ps->p++;
+		ps->p++;
+	}
+	if (ps->p >= ps->end)
+		return NULL;
+	const char *end = ps->p++;
+
+	char *str = arena_alloc(ps->arena, end - top + 1);
+	char *d = str;
+	Parser esc = { ps->arena, top, end };
+	while (esc.p < end) {
+		char c = *esc.p++;
+		if ((uint8_t)c < 0x20)
+			return NULL;
+		if (c != '\\') {
+			*d++ = c;
+			continue;
+		}
+		switch (*esc.p++) {
+		case '"': *d++ = '"'; break;
+		case '\\': *d++ = '\\'; break;
+		case '/': *d++ = '/'; break;
+		case 'b': *d++ = '\b'; break;
+		case 'f': *d++ = '\f'; break;
+		case 'n': *d++ = '\n'; break;
+		case 'r': *d++ = '\r'; break;
+		case 't': *d++ = '\t'; break;
+		case 'u':
+			{
+				int u = hex4(&esc);
+				if (u < 0)
+					return NULL;
+				if (0xd800 <= u && u < 0xdc00 && consume_literal(&esc, "\\u")) {
+					int lo = hex4(&esc);
+					if (lo < 0xdc00 || lo >= 0xe000)
+						return NULL;
+					u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+				}
+				d = put_utf8(d, u);
+			}
+			break;
+		default:
+			return NULL;
+		}
+	}
+	*d = '\0';
+	return str;
+}
+
+static bool parse_number(Parser *ps, double *v) {
+	const char *top = ps->p;
+	if (ps->p < ps->end && *ps->p == '-')
+		ps->p++;
+	while (ps->p < ps->end && strchr("0123456789.eE+-", *ps->p))
+		ps->p++;
+	if (ps->p == top || ps->p - top > 63)
+		return false;
+	char buf[64];
+	memcpy(buf, top, ps->p - top);
+	buf[ps->p - top] = '\0';
+	char *endp;
+	*v = strtod(buf, &endp);
+	return *endp == '\0';
+}
+
+// Nesting deeper than this is rejected rather than overflowing the stack.
+#define MAX_DEPTH 100
+
+static Json *parse_container(Parser *ps, Json *v, char close, int depth) {
+	if (depth > MAX_DEPTH)
+		return NULL;
+	if (consume_char(ps, close))
+		return v;
+	Json **tail = &v->child;
+	do {
+		const char *key = NULL;
+		if (v->type == JSON_OBJECT) {
+			if (!consume_char(ps, '"') || !(key = parse_string(ps)) || !consume_char(ps, ':'))
+				return NULL;
+		}
+		Json *item = parse_value(ps, depth + 1);
+		if (!item)
+			return NULL;
+		item->key = key;
+		*tail = item;
+		tail = &item->next;
+	} while (consume_char(ps, ','));
+	return consume_char(ps, close) ? v : NULL;
+}
+
+static Json *parse_value(Parser *ps, int depth) {
+	skip_ws(ps);
+	if (ps->p >= ps->end)
+		return NULL;
+	Json *v = arena_alloc(ps->arena, sizeof(Json));
+	switch (*ps->p) {
+	case '{':
+		ps->p++;
+		v->type = JSON_OBJECT;
+		return parse_container(ps, v, '}', depth);
+	case '[':
+		ps->p++;
+		v->type = JSON_ARRAY;
+		return parse_container(ps, v, ']', depth);
+	case '"':
+		ps->p++;
+		v->type = JSON_STRING;
+		v->string = parse_string(ps);
+		return v->string ? v : NULL;
+	case 'n':
+		v->type = JSON_NULL;
+		return consume_literal(ps, "null") ? v : NULL;
+	case 't':
+		v->type = JSON_TRUE;
+		return consume_literal(ps, "true") ? v : NULL;
+	case 'f':
+		v->type = JSON_FALSE;
+		return consume_literal(ps, "false") ? v : NULL;
+	default:
+		v->type = JSON_NUMBER;
+		return parse_number(ps, &v->number) ? v : NULL;
+	}
+}
+
+Json *json_parse(Arena *arena, const char *text, size_t len) {
+	Parser ps = { arena, text, text + len };
+	Json *v = parse_value(&ps, 0);
+	skip_ws(&ps);
+	return v && ps.p == ps.end ? v : NULL;
+}
+
+Json *json_get(const Json *obj, const char *key) {
+	if (!obj || obj->type != JSON_OBJECT)
+		return NULL;
+	for (Json *m = obj->child; m; m = m->next) {
+		if (!strcmp(m->key, key))
+			return m;
+	}
+	return NULL;
+}
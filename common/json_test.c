@@ -0,0 +1,63 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <string.h>
+
+static Json *parse(Arena *a, const char *s) {
+	return json_parse(a, s, strlen(s));
+}
+
+static void test_parse(void) {
+	Arena *a = new_arena();
+	Json *v = parse(a, " {\"id\": 3, \"params\": {\"text\": \"a\\n\\u3042\\ud83d\\ude00\"},"
+					"\"list\": [true, null, -1.5e1], \"empty\": {}} ");
+	assert(v && v->type == JSON_OBJECT);
+	assert(json_get(v, "id")->type == JSON_NUMBER && json_get(v, "id")->number == 3);
+	Json *text = json_get(json_get(v, "params"), "text");
+	assert(text->type == JSON_STRING && !strcmp(text->string, "a\n\xe3\x81\x82\xf0\x9f\x98\x80"));
+	Json *list = json_get(v, "list");
+	assert(list->child->type == JSON_TRUE);
+	assert(list->child->next->type == JSON_NULL);
+	assert(list->child->next->next->number == -15 && !list->child->next->next->next);
+	assert(json_get(v, "empty")->child == NULL);
+	assert(!json_get(v, "missing") && !json_get(text, "id"));
+	free_arena(a);
+}
+
+static void test_invalid(void) {
+	Arena *a = new_arena();
+	assert(!parse(a, ""));
+	assert(!parse(a, "{\"a\" 1}"));
+	assert(!parse(a, "[1, 2"));
+	assert(!parse(a, "[1] 2"));
+	assert(!parse(a, "\"abc"));
+	assert(!parse(a, "\"\\q\""));
+	assert(!parse(a, "tru"));
+	char deep[1000];
+	memset(deep, '[', sizeof(deep));
+	assert(!json_parse(a, deep, sizeof(deep)));
+	free_arena(a);
+}
+
+void json_test(void) {
+	test_parse();
+	test_invalid();
+}
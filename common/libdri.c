@@ -0,0 +1,599 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// This file is built into libdri together with fileio.c, so it must not call
+// error() or anything else in util.c.
+
+#include "libdri.h"
+#include "common.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ptr_nr in the link sector is 8-bit, so the pointers referenced from the link
+// sector never lie beyond this offset.
+#define DRI_PTR_AREA_SIZE 0x300
+
+// errno is saved at the failing call, since cleanup (free, close) on the way
+// back to the caller may overwrite it.
+static _Thread_local int last_errno;
+
+static DriStatus io_error(int err) {
+	last_errno = err;
+	return DRI_ERR_IO;
+}
+
+int dri_errno(void) {
+	return last_errno;
+}
+
+const char *dri_strerror(DriStatus status) {
+	switch (status) {
+	case DRI_OK: return "success";
+	case DRI_ERR_IO: return "I/O error";
+	case DRI_ERR_NOMEM: return "out of memory";
+	case DRI_ERR_BAD_NAME: return "cannot determine volume number from filename";
+	case DRI_ERR_BAD_SECTOR: return "sector offset out of range";
+	case DRI_ERR_BAD_SIZE: return "entry size exceeds end of dri file";
+	case DRI_ERR_CONFLICT: return "duplicate entry with different content";
+	case DRI_ERR_NO_ENTRY: return "no such entry";
+	case DRI_ERR_TOO_LARGE: return "volume too large";
+	case DRI_ERR_INVALID: return "invalid argument";
+	}
+	return "unknown error";
+}
+
+static inline size_t sectors(size_t size) {
+	return (size + 0xff) >> 8;
+}
+
+static inline bool in_volume(const DriSlice *s, int volume) {
+	return s->volume_bits & 1 << volume;
+}
+
+// Stores the byte offset of the sector pointed to by the index-th pointer.
+static DriStatus dri_sector(const uint8_t *header, size_t header_size, size_t dri_size, int index, size_t *offset) {
+	if ((size_t)index * 2 + 1 >= header_size)
+		return DRI_ERR_BAD_SECTOR;
+	const uint8_t *p = header + index * 2;
+	size_t sector = p[0] | p[1] << 8;
+	if (sector == 0 || (sector - 1) << 8 > dri_size)
+		return DRI_ERR_BAD_SECTOR;
+	*offset = (sector - 1) << 8;
+	return DRI_OK;
+}
+
+DriStatus dri_scan_volume(const uint8_t *header, size_t header_size, size_t dri_size, int volume, DriScanFunc func, void *ctx) {
+	DriStatus st;
+	size_t link_sector, link_sector_end;
+	if ((st = dri_sector(header, header_size, dri_size, 0, &link_sector)) != DRI_OK ||
+		(st = dri_sector(header, header_size, dri_size, 1, &link_sector_end)) != DRI_OK)
+		return st;
+	if (link_sector_end > header_size)
+		return DRI_ERR_BAD_SECTOR;
+
+	for (size_t link = link_sector; link + 1 < link_sector_end; link += 2) {
+		uint8_t vol_nr = header[link];
+		uint8_t ptr_nr = header[link + 1];
+		if (vol_nr != volume)
+			continue;
+		size_t entry_offset, entry_end;
+		if ((st = dri_sector(header, header_size, dri_size, ptr_nr, &entry_offset)) != DRI_OK ||
+			(st = dri_sector(header, header_size, dri_size, ptr_nr + 1, &entry_end)) != DRI_OK)
+			return st;
+		if (entry_end < entry_offset)
+			return DRI_ERR_BAD_SIZE;
+		int id = (link - link_sector) / 2 + 1;
+		if ((st = func(ctx, id, entry_offset, entry_end - entry_offset)) != DRI_OK)
+			return st;
+	}
+	return DRI_OK;
+}
+
+// Reads `size` bytes at `offset` into a new buffer, zero-filling past EOF.
+static DriStatus read_at(int fd, size_t offset, size_t size, uint8_t **pbuf) {
+	uint8_t *buf = calloc(1, size ? size : 1);
+	if (!buf)
+		return DRI_ERR_NOMEM;
+	if (lseek(fd, offset, SEEK_SET) < 0) {
+		int err = errno;
+		free(buf);
+		return io_error(err);
+	}
+	size_t bytes = 0;
+	while (bytes < size) {
+		ssize_t ret = read(fd, buf + bytes, size - bytes);
+		if (ret < 0) {
+			int err = errno;
+			free(buf);
+			return io_error(err);
+		}
+		if (ret == 0)
+			break;
+		bytes += ret;
+	}
+	*pbuf = buf;
+	return DRI_OK;
+}
+
+static DriStatus write_at(int fd, size_t offset, const uint8_t *buf, size_t size) {
+	if (lseek(fd, offset, SEEK_SET) < 0)
+		return io_error(errno);
+	while (size > 0) {
+		ssize_t ret = write(fd, buf, size);
+		if (ret < 0)
+			return io_error(errno);
+		if (ret == 0)
+			return io_error(EIO);
+		buf += ret;
+		size -= ret;
+	}
+	return DRI_OK;
+}
+
+static DriStatus file_size(int fd, size_t *size) {
+	struct stat sbuf;
+	if (fstat(fd, &sbuf) < 0)
+		return io_error(errno);
+	*size = sbuf.st_size;
+	return DRI_OK;
+}
+
+// Reads the pointer sector and the link sector.
+static DriStatus read_header(int fd, size_t dri_size, uint8_t **pheader, size_t *pheader_size) {
+	uint8_t *header;
+	DriStatus st = read_at(fd, 0, 256, &header);
+	if (st != DRI_OK)
+		return st;
+	size_t header_size;
+	st = dri_sector(header, 256, dri_size, 1, &header_size);
+	free(header);
+	if (st != DRI_OK)
+		return st;
+	if (header_size < DRI_PTR_AREA_SIZE)
+		header_size = DRI_PTR_AREA_SIZE;
+	if ((st = read_at(fd, 0, header_size, pheader)) != DRI_OK)
+		return st;
+	*pheader_size = header_size;
+	return DRI_OK;
+}
+
+DriStatus dri_load_header(const char *path_utf8, uint8_t **header, size_t *header_size, size_t *dri_size) {
+	int fd = open_utf8(path_utf8, O_RDONLY, 0);
+	if (fd == -1)
+		return io_error(errno);
+	size_t size;
+	DriStatus st = file_size(fd, &size);
+	if (st == DRI_OK) {
+		size = (size + 0xff) & ~0xff;
+		st = read_header(fd, size, header, header_size);
+	}
+	close(fd);
+	if (st == DRI_OK)
+		*dri_size = size;
+	return st;
+}
+
+DriStatus dri_load_range(const char *path_utf8, size_t offset, size_t size, uint8_t **buf) {
+	int fd = open_utf8(path_utf8, O_RDONLY, 0);
+	if (fd == -1)
+		return io_error(errno);
+	DriStatus st = read_at(fd, offset, size, buf);
+	close(fd);
+	return st;
+}
+
+DriStatus dri_layout_volume(const DriSlice *slices, int count, int volume, uint8_t **pimage, size_t *psize) {
+	if (volume < 1 || volume > DRI_MAX_VOLUME || count < 0)
+		return DRI_ERR_INVALID;
+	size_t ptr_count = 0;
+	size_t data_sectors = 0;
+	for (int i = 0; i < count; i++) {
+		if (in_volume(&slices[i], volume)) {
+			ptr_count++;
+			data_sectors += sectors(slices[i].size);
+		}
+	}
+	size_t ptr_sectors = sectors((ptr_count + 3) * 2);
+	size_t link_sectors = sectors((size_t)count * 2 + 1);
+	size_t total_sectors = ptr_sectors + link_sectors + data_sectors;
+	// Pointers are 16-bit, and ptr_nr in the link sector is 8-bit.
+	if (total_sectors >= 0xffff || ptr_count > 0xff)
+		return DRI_ERR_TOO_LARGE;
+	size_t size = total_sectors << 8;
+	uint8_t *image = calloc(1, size);
+	if (!image)
+		return DRI_ERR_NOMEM;
+
+	// Pointer sector. Pointers are 1-based sector numbers.
+	uint8_t *ptr = image;
+	size_t sector = ptr_sectors;
+	*ptr++ = (sector + 1) & 0xff;
+	*ptr++ = (sector + 1) >> 8 & 0xff;
+	sector += link_sectors;
+	*ptr++ = (sector + 1) & 0xff;
+	*ptr++ = (sector + 1) >> 8 & 0xff;
+	uint8_t *p = image + (sector << 8);
+	for (int i = 0; i < count; i++) {
+		const DriSlice *s = &slices[i];
+		if (!in_volume(s, volume))
+			continue;
+		if (s->size > 0)
+			memcpy(p, s->data, s->size);
+		p += sectors(s->size) << 8;
+		sector += sectors(s->size);
+		*ptr++ = (sector + 1) & 0xff;
+		*ptr++ = (sector + 1) >> 8 & 0xff;
+	}
+
+	// Link sector
+	uint8_t *link_sector = image + (ptr_sectors << 8);
+	uint16_t link[DRI_MAX_VOLUME + 1];
+	memset(link, 0, sizeof(link));
+	for (int i = 0; i < count; i++) {
+		int vol = 0;
+		for (int j = 1; j <= DRI_MAX_VOLUME; j++) {
+			if (slices[i].volume_bits & 1 << j) {
+				link[j]++;
+				if (!vol || j == volume)
+					vol = j;
+			}
+		}
+		link_sector[i * 2] = vol;
+		link_sector[i * 2 + 1] = link[vol];
+	}
+	link_sector[count * 2] = 0x1a;  // EOF
+
+	*pimage = image;
+	*psize = size;
+	return DRI_OK;
+}
+
+static DriStatus patch_volume(int fd, int volume, int id, const void *data, size_t size) {
+	size_t file_sz;
+	DriStatus st = file_size(fd, &file_sz);
+	if (st != DRI_OK)
+		return st;
+	size_t dri_size = (file_sz + 0xff) & ~0xff;
+
+	uint8_t *header;
+	size_t header_size;
+	if ((st = read_header(fd, dri_size, &header, &header_size)) != DRI_OK)
+		return st;
+
+	size_t link_sector, link_sector_end, start, end;
+	if ((st = dri_sector(header, header_size, dri_size, 0, &link_sector)) != DRI_OK ||
+		(st = dri_sector(header, header_size, dri_size, 1, &link_sector_end)) != DRI_OK)
+		goto out;
+	size_t link = link_sector + (size_t)(id - 1) * 2;
+	if (id < 1 || link + 1 >= link_sector_end || header[link] != volume) {
+		st = DRI_ERR_NO_ENTRY;
+		goto out;
+	}
+	int ptr_nr = header[link + 1];
+	if ((st = dri_sector(header, header_size, dri_size, ptr_nr, &start)) != DRI_OK ||
+		(st = dri_sector(header, header_size, dri_size, ptr_nr + 1, &end)) != DRI_OK)
+		goto out;
+	if (end < start) {
+		st = DRI_ERR_BAD_SIZE;
+		goto out;
+	}
+
+	size_t new_end = start + (sectors(size) << 8);
+	if (new_end <= end) {
+		// The new data fit in the current sectors; overwrite them, clearing
+		// the remaining bytes.
+		uint8_t *buf = calloc(1, end - start + 1);
+		if (!buf) {
+			st = DRI_ERR_NOMEM;
+			goto out;
+		}
+		memcpy(buf, data, size);
+		st = write_at(fd, start, buf, end - start);
+		free(buf);
+		goto out;
+	}
+
+	// Shift the pointers that follow, then move the rest of the volume back.
+	// The pointers are checked before anything is written, so
+	// DRI_ERR_TOO_LARGE leaves the file intact. The move itself is not atomic:
+	// the pointer sector is written last, but the moved tail and the new data
+	// overwrite sectors the old pointers refer to, so an I/O error part way
+	// through leaves the volume inconsistent.
+	size_t delta = (new_end - end) >> 8;
+	size_t ptr_sector_end = link_sector;
+	for (size_t i = ptr_nr + 1; i * 2 + 1 < ptr_sector_end; i++) {
+		uint8_t *p = header + i * 2;
+		size_t n = p[0] | p[1] << 8;
+		if (!n)
+			break;
+		n += delta;
+		if (n > 0xffff) {
+			st = DRI_ERR_TOO_LARGE;
+			goto out;
+		}
+		p[0] = n & 0xff;
+		p[1] = n >> 8;
+	}
+
+	size_t tail_size = file_sz > end ? file_sz - end : 0;
+	uint8_t *tail, *buf;
+	if ((st = read_at(fd, end, tail_size, &tail)) != DRI_OK)
+		goto out;
+	buf = calloc(1, new_end - start);
+	if (!buf) {
+		free(tail);
+		st = DRI_ERR_NOMEM;
+		goto out;
+	}
+	memcpy(buf, data, size);
+	if ((st = write_at(fd, new_end, tail, tail_size)) == DRI_OK &&
+		(st = write_at(fd, start, buf, new_end - start)) == DRI_OK)
+		st = write_at(fd, 0, header, ptr_sector_end);
+	free(buf);
+	free(tail);
+ out:
+	free(header);
+	return st;
+}
+
+DriStatus dri_patch_volume(const char *path_utf8, int volume, int id, const void *data, size_t size) {
+	int fd = open_utf8(path_utf8, O_RDWR, 0);
+	if (fd == -1)
+		return io_error(errno);
+	DriStatus st = patch_volume(fd, volume, id, data, size);
+	if (close(fd) != 0 && st == DRI_OK)
+		st = io_error(errno);
+	return st;
+}
+
+int dri_volume_number(const char *fname) {
+	// ADISK.DAT, BDISK.DAT, ...
+	char *ext = strrchr(fname, '.');
+	if (ext && !strcasecmp(ext, ".DAT") && isalpha(fname[0]))
+		return toupper(fname[0]) - 'A' + 1;
+	// DISK-A, DISK-B, ...
+	char *hyphen = strrchr(fname, '-');
+	if (hyphen && isalpha(hyphen[1]) && hyphen[2] == '\0')
+		return toupper(hyphen[1]) - 'A' + 1;
+	return 0;
+}
+
+bool dri_filename(char *adisk_name, int volume) {
+	// A*.DAT
+	char *ext = strrchr(adisk_name, '.');
+	if (ext && !strcasecmp(ext, ".DAT") && toupper(adisk_name[0]) == 'A') {
+		adisk_name[0] += volume - 1;
+		return true;
+	}
+	// *-A
+	char *hyphen = strrchr(adisk_name, '-');
+	if (hyphen && toupper(hyphen[1]) == 'A' && hyphen[2] == '\0') {
+		hyphen[1] += volume - 1;
+		return true;
+	}
+	return false;
+}
+
+// Archive handle
+
+typedef struct {
+	DriSlice slice;
+	void *owned;  // copy made by dri_archive_put()
+} Item;
+
+struct DriArchive {
+	Item *items;  // items[id - 1]
+	int nr_items;
+	MappedFile **files;
+	int nr_files;
+};
+
+DriArchive *dri_archive_new(void) {
+	return calloc(1, sizeof(DriArchive));
+}
+
+void dri_archive_close(DriArchive *a) {
+	if (!a)
+		return;
+	for (int i = 0; i < a->nr_items; i++)
+		free(a->items[i].owned);
+	free(a->items);
+	for (int i = 0; i < a->nr_files; i++)
+		unmap_file(a->files[i]);
+	free(a->files);
+	free(a);
+}
+
+static DriStatus reserve_items(DriArchive *a, int n) {
+	if (n <= a->nr_items)
+		return DRI_OK;
+	Item *items = realloc(a->items, n * sizeof(Item));
+	if (!items)
+		return DRI_ERR_NOMEM;
+	memset(items + a->nr_items, 0, (n - a->nr_items) * sizeof(Item));
+	a->items = items;
+	a->nr_items = n;
+	return DRI_OK;
+}
+
+static const char *path_basename(const char *path) {
+	const char *base = path;
+	for (const char *p = path; *p; p++) {
+#ifdef _WIN32
+		if (*p == '\\')
+			base = p + 1;
+#endif
+		if (*p == '/')
+			base = p + 1;
+	}
+	return base;
+}
+
+typedef struct {
+	DriArchive *archive;
+	const MappedFile *file;
+	int volume;
+	int max_id;
+	bool commit;
+} OpenContext;
+
+static DriStatus add_entry(void *ctx, int id, size_t offset, size_t size) {
+	OpenContext *oc = ctx;
+	DriArchive *a = oc->archive;
+	const uint8_t *data = oc->file->data + offset;
+	if (!oc->commit) {
+		// First pass: check for conflicts without modifying the archive.
+		if (id > oc->max_id)
+			oc->max_id = id;
+		if (id <= a->nr_items && a->items[id - 1].slice.volume_bits) {
+			const DriSlice *s = &a->items[id - 1].slice;
+			if (s->size != size || memcmp(s->data, data, size))
+				return DRI_ERR_CONFLICT;
+		}
+		return DRI_OK;
+	}
+	Item *item = &a->items[id - 1];
+	if (!item->slice.volume_bits) {
+		item->slice.data = data;
+		item->slice.size = size;
+	}
+	item->slice.volume_bits |= 1 << oc->volume;
+	return DRI_OK;
+}
+
+DriStatus dri_archive_open(DriArchive *a, const char *path_utf8) {
+	int volume = dri_volume_number(path_basename(path_utf8));
+	if (!volume || volume > DRI_MAX_VOLUME)
+		return DRI_ERR_BAD_NAME;
+
+	MappedFile *mf;
+	int err = try_map_file(path_utf8, &mf);
+	if (err) {
+		return err == ENOMEM ? DRI_ERR_NOMEM : io_error(err);
+	}
+	MappedFile **files = realloc(a->files, (a->nr_files + 1) * sizeof(MappedFile *));
+	if (!files) {
+		unmap_file(mf);
+		return DRI_ERR_NOMEM;
+	}
+	a->files = files;
+
+	size_t dri_size = (mf->size + 0xff) & ~0xff;
+	OpenContext oc = { .archive = a, .file = mf, .volume = volume };
+	DriStatus st = dri_scan_volume(mf->data, dri_size, dri_size, volume, add_entry, &oc);
+	if (st == DRI_OK)
+		st = reserve_items(a, oc.max_id);
+	if (st != DRI_OK) {
+		unmap_file(mf);
+		return st;
+	}
+	oc.commit = true;
+	dri_scan_volume(mf->data, dri_size, dri_size, volume, add_entry, &oc);
+	a->files[a->nr_files++] = mf;
+	return DRI_OK;
+}
+
+int dri_archive_next(const DriArchive *a, int id) {
+	for (int i = id < 0 ? 0 : id; i < a->nr_items; i++) {
+		if (a->items[i].slice.volume_bits)
+			return i + 1;
+	}
+	return 0;
+}
+
+DriStatus dri_archive_get(const DriArchive *a, int id, const uint8_t **data, size_t *size, uint32_t *volume_bits) {
+	if (id < 1 || id > a->nr_items || !a->items[id - 1].slice.volume_bits)
+		return DRI_ERR_NO_ENTRY;
+	const DriSlice *s = &a->items[id - 1].slice;
+	if (data)
+		*data = s->data;
+	if (size)
+		*size = s->size;
+	if (volume_bits)
+		*volume_bits = s->volume_bits;
+	return DRI_OK;
+}
+
+DriStatus dri_archive_put(DriArchive *a, int id, const void *data, size_t size, uint32_t volume_bits) {
+	uint32_t valid_bits = ((1u << DRI_MAX_VOLUME) - 1) << 1;
+	if (id < 1 || !volume_bits || volume_bits & ~valid_bits || (size && !data))
+		return DRI_ERR_INVALID;
+	void *copy = malloc(size ? size : 1);
+	if (!copy)
+		return DRI_ERR_NOMEM;
+	DriStatus st = reserve_items(a, id);
+	if (st != DRI_OK) {
+		free(copy);
+		return st;
+	}
+	if (size)
+		memcpy(copy, data, size);
+	Item *item = &a->items[id - 1];
+	free(item->owned);
+	item->owned = copy;
+	item->slice.data = copy;
+	item->slice.size = size;
+	item->slice.volume_bits = volume_bits;
+	return DRI_OK;
+}
+
+uint32_t dri_archive_volumes(const DriArchive *a) {
+	uint32_t bits = 0;
+	for (int i = 0; i < a->nr_items; i++)
+		bits |= a->items[i].slice.volume_bits;
+	return bits;
+}
+
+DriStatus dri_archive_build(const DriArchive *a, int volume, uint8_t **image, size_t *size) {
+	// Trailing ids without entries are not stored.
+	int count = a->nr_items;
+	while (count > 0 && !a->items[count - 1].slice.volume_bits)
+		count--;
+	DriSlice *slices = malloc((count ? count : 1) * sizeof(DriSlice));
+	if (!slices)
+		return DRI_ERR_NOMEM;
+	for (int i = 0; i < count; i++)
+		slices[i] = a->items[i].slice;
+	DriStatus st = dri_layout_volume(slices, count, volume, image, size);
+	free(slices);
+	return st;
+}
+
+DriStatus dri_archive_write(const DriArchive *a, int volume, const char *path_utf8) {
+	uint8_t *image;
+	size_t size;
+	DriStatus st = dri_archive_build(a, volume, &image, &size);
+	if (st != DRI_OK)
+		return st;
+	int fd = open_utf8(path_utf8, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		int err = errno;
+		free(image);
+		return io_error(err);
+	}
+	st = write_at(fd, 0, image, size);
+	if (close(fd) != 0 && st == DRI_OK)
+		st = io_error(errno);
+	free(image);
+	return st;
+}
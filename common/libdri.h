@@ -0,0 +1,107 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// libdri: reading and writing DRI archives (ADISK.DAT, BDISK.DAT, ...).
+// Nothing in this library exits the process; every failure is reported to
+// the caller as a DriStatus.
+
+#ifndef LIBDRI_H
+#define LIBDRI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DRI_MAX_VOLUME 26
+
+typedef enum {
+	DRI_OK = 0,
+	DRI_ERR_IO,          // a system call failed; dri_errno() tells why
+	DRI_ERR_NOMEM,
+	DRI_ERR_BAD_NAME,    // volume number cannot be determined from the filename
+	DRI_ERR_BAD_SECTOR,  // sector offset out of range
+	DRI_ERR_BAD_SIZE,    // entry size exceeds end of dri file
+	DRI_ERR_CONFLICT,    // duplicate entry with different content
+	DRI_ERR_NO_ENTRY,
+	DRI_ERR_TOO_LARGE,   // volume exceeds 0xffff sectors
+	DRI_ERR_INVALID,     // invalid argument
+} DriStatus;
+
+const char *dri_strerror(DriStatus status);
+// Returns the errno value of the system call that caused the last DRI_ERR_IO
+// in the calling thread.
+int dri_errno(void);
+
+// An archive is a set of entries, each of which is stored in one or more
+// volumes. Entry ids are 1-based.
+typedef struct DriArchive DriArchive;
+
+// Returns a new empty archive, or NULL if out of memory.
+DriArchive *dri_archive_new(void);
+// Adds the entries of the volume file at `path` to the archive. The volume
+// number is taken from the filename. The file is mapped until the archive is
+// closed. On failure the archive is left unchanged.
+DriStatus dri_archive_open(DriArchive *archive, const char *path_utf8);
+void dri_archive_close(DriArchive *archive);
+
+// Returns the smallest entry id greater than `id`, or 0 if there is none.
+// Iterate with: for (int id = 0; (id = dri_archive_next(a, id));)
+int dri_archive_next(const DriArchive *archive, int id);
+DriStatus dri_archive_get(const DriArchive *archive, int id, const uint8_t **data, size_t *size, uint32_t *volume_bits);
+// Adds or replaces entry `id`. `data` is copied. (1 << k) in `volume_bits`
+// places the entry in the k-th volume.
+DriStatus dri_archive_put(DriArchive *archive, int id, const void *data, size_t size, uint32_t volume_bits);
+// Returns the set of volumes that have at least one entry.
+uint32_t dri_archive_volumes(const DriArchive *archive);
+// Builds the image of the given volume in a malloc()ed buffer.
+DriStatus dri_archive_build(const DriArchive *archive, int volume, uint8_t **image, size_t *size);
+DriStatus dri_archive_write(const DriArchive *archive, int volume, const char *path_utf8);
+
+// Low-level interface, used by the sys3c tools.
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	uint32_t volume_bits;  // 0 if there is no entry with this id
+} DriSlice;
+
+// Called for each entry of the volume. A non-DRI_OK return value stops the
+// scan and is returned from dri_scan_volume().
+typedef DriStatus (*DriScanFunc)(void *ctx, int id, size_t offset, size_t size);
+
+// `header` must contain the pointer sector and the link sector of a volume
+// whose size, rounded up to a sector boundary, is `dri_size`.
+DriStatus dri_scan_volume(const uint8_t *header, size_t header_size, size_t dri_size, int volume, DriScanFunc func, void *ctx);
+// Reads the pointer sector and the link sector of the volume file.
+DriStatus dri_load_header(const char *path_utf8, uint8_t **header, size_t *header_size, size_t *dri_size);
+// Reads `size` bytes at `offset` of the file. Bytes past the end of the file
+// read as zero, as in a padded volume image.
+DriStatus dri_load_range(const char *path_utf8, size_t offset, size_t size, uint8_t **buf);
+// slices[i] is the entry with id i + 1.
+DriStatus dri_layout_volume(const DriSlice *slices, int count, int volume, uint8_t **image, size_t *size);
+// Replaces the data of entry `id` in the volume file in place. Only the
+// affected sectors are rewritten unless the entry grows, in which case the
+// rest of the volume is moved back. A shrinking entry keeps its old sectors,
+// zero-filled past `size`. Moving is not atomic; an I/O error while moving
+// leaves the volume inconsistent.
+DriStatus dri_patch_volume(const char *path_utf8, int volume, int id, const void *data, size_t size);
+
+int dri_volume_number(const char *fname);
+bool dri_filename(char *adisk_name, int volume);
+
+#endif // LIBDRI_H
@@ -0,0 +1,183 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "libdri.h"
+#include "common.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const uint8_t *image;
+	int count;
+	int ids[4];
+} ScanResult;
+
+static DriStatus collect(void *ctx, int id, size_t offset, size_t size) {
+	ScanResult *r = ctx;
+	assert(offset % 256 == 0);
+	if (id == 1)
+		assert(size == 256 && !memcmp(r->image + offset, "foo", 4));
+	if (id == 3)
+		assert(size == 512 && r->image[offset + 299] == 0xaa);
+	r->ids[r->count++] = id;
+	return DRI_OK;
+}
+
+static void test_build_and_scan(void) {
+	DriArchive *a = dri_archive_new();
+	uint8_t big[300];
+	memset(big, 0xaa, sizeof(big));
+	assert(dri_archive_put(a, 1, "foo", 4, 1 << 1 | 1 << 2) == DRI_OK);
+	assert(dri_archive_put(a, 2, "bar", 4, 1 << 2) == DRI_OK);
+	assert(dri_archive_put(a, 3, big, sizeof(big), 1 << 1) == DRI_OK);
+	assert(dri_archive_volumes(a) == (1 << 1 | 1 << 2));
+
+	int ids[3], n = 0;
+	for (int id = 0; (id = dri_archive_next(a, id));)
+		ids[n++] = id;
+	assert(n == 3 && ids[0] == 1 && ids[2] == 3);
+
+	uint8_t *image;
+	size_t size;
+	assert(dri_archive_build(a, 1, &image, &size) == DRI_OK);
+	assert(size == 256 * 5);
+	ScanResult r = { .image = image };
+	assert(dri_scan_volume(image, size, size, 1, collect, &r) == DRI_OK);
+	assert(r.count == 2 && r.ids[0] == 1 && r.ids[1] == 3);
+	// A truncated header is rejected rather than read past.
+	assert(dri_scan_volume(image, 4, size, 1, collect, &r) == DRI_ERR_BAD_SECTOR);
+	free(image);
+
+	dri_archive_close(a);
+}
+
+static void test_errors(void) {
+	DriArchive *a = dri_archive_new();
+	const uint8_t *data;
+	assert(dri_archive_get(a, 1, &data, NULL, NULL) == DRI_ERR_NO_ENTRY);
+	assert(dri_archive_put(a, 0, "x", 1, 1 << 1) == DRI_ERR_INVALID);
+	assert(dri_archive_put(a, 1, "x", 1, 0) == DRI_ERR_INVALID);
+	assert(dri_archive_open(a, "foo.bin") == DRI_ERR_BAD_NAME);
+	assert(dri_archive_open(a, "nonexistent/ADISK.DAT") == DRI_ERR_IO);
+	assert(dri_errno() == ENOENT);
+	assert(dri_archive_next(a, 0) == 0);
+	dri_archive_close(a);
+}
+
+#define PATCH_TEST_FILE "libdri_patch_test.dat"
+
+typedef struct {
+	int count;
+	int ids[8];
+	size_t sizes[8];
+} PatchScan;
+
+static DriStatus collect_sizes(void *ctx, int id, size_t offset, size_t size) {
+	PatchScan *r = ctx;
+	r->ids[r->count] = id;
+	r->sizes[r->count++] = size;
+	return DRI_OK;
+}
+
+// Checks that volume 1 in PATCH_TEST_FILE is exactly the image of `expected`
+// and that a rescan finds the same entries.
+static void check_patched(const DriArchive *expected) {
+	uint8_t *image;
+	size_t size;
+	assert(dri_archive_build(expected, 1, &image, &size) == DRI_OK);
+	MappedFile *mf = map_file(PATCH_TEST_FILE);
+	assert(mf->size == size && !memcmp(mf->data, image, size));
+	unmap_file(mf);
+
+	uint8_t *header;
+	size_t header_size, dri_size;
+	assert(dri_load_header(PATCH_TEST_FILE, &header, &header_size, &dri_size) == DRI_OK);
+	PatchScan got = {0}, want = {0};
+	assert(dri_scan_volume(header, header_size, dri_size, 1, collect_sizes, &got) == DRI_OK);
+	assert(dri_scan_volume(image, size, size, 1, collect_sizes, &want) == DRI_OK);
+	assert(got.count == want.count);
+	for (int i = 0; i < got.count; i++)
+		assert(got.ids[i] == want.ids[i] && got.sizes[i] == want.sizes[i]);
+	free(header);
+	free(image);
+}
+
+static void test_patch(void) {
+	uint8_t big[300], grown[600], shrunk[512] = "x";
+	memset(big, 0xaa, sizeof(big));
+	memset(grown, 0xbb, sizeof(grown));
+
+	DriArchive *a = dri_archive_new();
+	assert(dri_archive_put(a, 1, "foo", 4, 1 << 1) == DRI_OK);
+	assert(dri_archive_put(a, 2, big, sizeof(big), 1 << 1) == DRI_OK);
+	assert(dri_archive_put(a, 3, "baz", 4, 1 << 1) == DRI_OK);
+	assert(dri_archive_put(a, 4, "qux", 4, 1 << 2) == DRI_OK);
+	assert(dri_archive_write(a, 1, PATCH_TEST_FILE) == DRI_OK);
+	check_patched(a);
+
+	// Fits in the current sector.
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 1, "hello", 6) == DRI_OK);
+	assert(dri_archive_put(a, 1, "hello", 6, 1 << 1) == DRI_OK);
+	check_patched(a);
+
+	// Shrinks: the entry keeps both of its sectors, zero-filled.
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 2, "x", 2) == DRI_OK);
+	assert(dri_archive_put(a, 2, shrunk, sizeof(shrunk), 1 << 1) == DRI_OK);
+	check_patched(a);
+
+	// Grows: the pointers of entries 2 and 3 move and so does their data.
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 1, grown, sizeof(grown)) == DRI_OK);
+	assert(dri_archive_put(a, 1, grown, sizeof(grown), 1 << 1) == DRI_OK);
+	check_patched(a);
+
+	// Failures leave the file untouched.
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 0, "x", 2) == DRI_ERR_NO_ENTRY);
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 4, "x", 2) == DRI_ERR_NO_ENTRY);
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 5, "x", 2) == DRI_ERR_NO_ENTRY);
+	size_t huge_size = 0xffff << 8;
+	uint8_t *huge = calloc(1, huge_size);
+	assert(huge);
+	assert(dri_patch_volume(PATCH_TEST_FILE, 1, 1, huge, huge_size) == DRI_ERR_TOO_LARGE);
+	free(huge);
+	check_patched(a);
+
+	remove(PATCH_TEST_FILE);
+	dri_archive_close(a);
+}
+
+static void test_volume_number(void) {
+	assert(dri_volume_number("ADISK.DAT") == 1);
+	assert(dri_volume_number("cdisk.dat") == 3);
+	assert(dri_volume_number("DISK-B") == 2);
+	assert(dri_volume_number("DISK.BIN") == 0);
+
+	char name[] = "ADISK.DAT";
+	assert(dri_filename(name, 4));
+	assert(!strcmp(name, "DDISK.DAT"));
+}
+
+void libdri_test(void) {
+	test_build_and_scan();
+	test_errors();
+	test_patch();
+	test_volume_number();
+}
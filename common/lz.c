@@ -0,0 +1,160 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// A small LZ77 codec for embedding text in debug information.
+//
+// The compressed data is a sequence of (literals, match) pairs. Each pair
+// starts with a token byte whose upper 4 bits are the number of literals and
+// whose lower 4 bits are the match length minus 4. A value of 15 in either
+// field is followed by extra bytes that are added to it, continuing while the
+// byte is 255. Then follow the literal bytes, and a 16-bit little-endian
+// distance back into the output to copy the match from. The last pair may end
+// after its literals, when the output is complete.
+
+#include "common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+#define MAX_DISTANCE 0xffff
+#define HASH_BITS 15
+#define MAX_CHAIN 32
+
+static uint32_t hash4(const uint8_t *p) {
+	return (le32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t *emit_length(uint8_t *op, size_t n) {
+	if (n < 15)
+		return op;
+	for (n -= 15; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = n;
+	return op;
+}
+
+static uint8_t *emit_pair(uint8_t *op, const uint8_t *literals, size_t nr_literals, size_t match_len, size_t distance) {
+	size_t m = match_len ? match_len - MIN_MATCH : 0;
+	*op++ = (nr_literals < 15 ? nr_literals : 15) << 4 | (m < 15 ? m : 15);
+	op = emit_length(op, nr_literals);
+	memcpy(op, literals, nr_literals);
+	op += nr_literals;
+	if (match_len) {
+		*op++ = distance & 0xff;
+		*op++ = distance >> 8;
+		op = emit_length(op, m);
+	}
+	return op;
+}
+
+uint8_t *lz_compress(const uint8_t *src, size_t len, size_t *out_len) {
+	uint8_t *out = malloc(len + len / 255 + 16);
+	uint8_t *op = out;
+	int32_t *head = malloc(sizeof(int32_t) << HASH_BITS);
+	int32_t *prev = malloc(sizeof(int32_t) * (len ? len : 1));
+	memset(head, 0xff, sizeof(int32_t) << HASH_BITS);
+
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + MIN_MATCH <= len) {
+		// Find the longest match among the recent occurrences of the next
+		// four bytes.
+		uint32_t h = hash4(src + i);
+		size_t best_len = 0, best_distance = 0;
+		int n = 0;
+		for (int32_t c = head[h]; c >= 0 && i - c <= MAX_DISTANCE && n < MAX_CHAIN; c = prev[c], n++) {
+			size_t l = 0;
+			while (i + l < len && src[c + l] == src[i + l])
+				l++;
+			if (l > best_len) {
+				best_len = l;
+				best_distance = i - c;
+			}
+		}
+		prev[i] = head[h];
+		head[h] = i;
+		if (best_len < MIN_MATCH) {
+			i++;
+			continue;
+		}
+
+		op = emit_pair(op, src + anchor, i - anchor, best_len, best_distance);
+		for (size_t j = i + 1; j < i + best_len && j + MIN_MATCH <= len; j++) {
+			h = hash4(src + j);
+			prev[j] = head[h];
+			head[h] = j;
+		}
+		i += best_len;
+		anchor = i;
+	}
+	if (anchor < len)
+		op = emit_pair(op, src + anchor, len - anchor, 0, 0);
+
+	free(head);
+	free(prev);
+	*out_len = op - out;
+	return out;
+}
+
+static bool read_length(const uint8_t **ip, const uint8_t *end, size_t *n) {
+	if (*n < 15)
+		return true;
+	uint8_t b;
+	do {
+		if (*ip == end)
+			return false;
+		b = *(*ip)++;
+		*n += b;
+	} while (b == 255);
+	return true;
+}
+
+bool lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len) {
+	const uint8_t *ip = src, *iend = src + src_len;
+	uint8_t *op = dst, *oend = dst + dst_len;
+	while (op < oend) {
+		if (ip == iend)
+			return false;
+		uint8_t token = *ip++;
+
+		size_t n = token >> 4;
+		if (!read_length(&ip, iend, &n) || n > (size_t)(iend - ip) || n > (size_t)(oend - op))
+			return false;
+		memcpy(op, ip, n);
+		ip += n;
+		op += n;
+		if (op == oend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		size_t distance = le16(ip);
+		ip += 2;
+		n = token & 15;
+		if (!read_length(&ip, iend, &n))
+			return false;
+		n += MIN_MATCH;
+		if (distance == 0 || distance > (size_t)(op - dst) || n > (size_t)(oend - op))
+			return false;
+		// The source and destination may overlap, so copy byte by byte.
+		for (size_t i = 0; i < n; i++)
+			op[i] = op[i - distance];
+		op += n;
+	}
+	return ip == iend;
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void round_trip(const uint8_t *data, size_t len) {
+	size_t packed_len;
+	uint8_t *packed = lz_compress(data, len, &packed_len);
+	uint8_t *unpacked = malloc(len + 1);
+	assert(lz_decompress(packed, packed_len, unpacked, len));
+	assert(!memcmp(unpacked, data, len));
+	// The output size must match exactly.
+	if (len > 0)
+		assert(!lz_decompress(packed, packed_len, unpacked, len - 1));
+	assert(!lz_decompress(packed, packed_len, unpacked, len + 1));
+	free(unpacked);
+	free(packed);
+}
+
+static void test_round_trip(void) {
+	round_trip((const uint8_t *)"", 0);
+	round_trip((const uint8_t *)"abc", 3);
+	round_trip((const uint8_t *)"abcabcabcabcabcabcabcabcabcabcx", 31);
+
+	size_t len = 200000;
+	uint8_t *buf = malloc(len);
+	uint32_t seed = 1;
+	for (size_t i = 0; i < len; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+	round_trip(buf, len);
+	// Long runs need extended literal and match lengths.
+	memset(buf + 1000, 'x', 70000);
+	round_trip(buf, len);
+
+	const char line[] = "\t!RND:1!\n\t{RND = 1: @next:}\n";
+	for (size_t i = 0; i < len; i++)
+		buf[i] = line[i % (sizeof(line) - 1)];
+	size_t packed_len;
+	free(lz_compress(buf, len, &packed_len));
+	assert(packed_len < len / 100);
+	round_trip(buf, len);
+	free(buf);
+}
+
+static void test_corrupted(void) {
+	uint8_t out[16];
+	// Distance pointing before the start of the output
+	assert(!lz_decompress((const uint8_t *)"\x10" "a\x02\x00", 4, out, 5));
+	// Truncated input
+	assert(!lz_decompress((const uint8_t *)"\x30" "ab", 3, out, 3));
+	// Trailing garbage
+	assert(!lz_decompress((const uint8_t *)"\x10" "a!", 3, out, 1));
+}
+
+void lz_test(void) {
+	test_round_trip();
+	test_corrupted();
+}
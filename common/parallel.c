@@ -0,0 +1,165 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+#include "common.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifndef __EMSCRIPTEN__
+#define HAVE_THREADS
+#include <pthread.h>
+#endif
+
+typedef struct {
+	int n;
+	atomic_int next;
+	void (*func)(void *ctx, int i);
+	void *ctx;
+} Work;
+
+static void *worker(void *arg) {
+	Work *w = arg;
+	int i;
+	while ((i = atomic_fetch_add(&w->next, 1)) < w->n)
+		w->func(w->ctx, i);
+	return NULL;
+}
+
+void parallel_for(int n, int jobs, void (*func)(void *ctx, int i), void *ctx) {
+	Work w = { .n = n, .func = func, .ctx = ctx };
+	atomic_init(&w.next, 0);
+
+#ifdef HAVE_THREADS
+	if (jobs > n)
+		jobs = n;
+	if (jobs > 1) {
+		pthread_t *threads = calloc(jobs - 1, sizeof(pthread_t));
+		for (int i = 0; i < jobs - 1; i++) {
+			int err = pthread_create(&threads[i], NULL, worker, &w);
+			if (err)
+				error("pthread_create: %s", strerror(err));
+		}
+		worker(&w);  // The calling thread is one of the workers.
+		for (int i = 0; i < jobs - 1; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+		return;
+	}
+#endif
+	worker(&w);
+}
+
+struct Pipeline {
+	int n;
+	int window;
+	void (*func)(void *ctx, int i);
+	void *ctx;
+	int done;      // func has returned for [0, done)
+	int consumer;  // index the consumer is waiting for
+	bool stop;
+#ifdef HAVE_THREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+#endif
+};
+
+#ifdef HAVE_THREADS
+static void *producer(void *arg) {
+	Pipeline *p = arg;
+	for (int i = 0; i < p->n; i++) {
+		pthread_mutex_lock(&p->mutex);
+		while (!p->stop && i > p->consumer + p->window)
+			pthread_cond_wait(&p->cond, &p->mutex);
+		bool stop = p->stop;
+		pthread_mutex_unlock(&p->mutex);
+		if (stop)
+			break;
+
+		p->func(p->ctx, i);
+
+		pthread_mutex_lock(&p->mutex);
+		p->done = i + 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->mutex);
+	}
+	return NULL;
+}
+#endif
+
+Pipeline *pipeline_start(int n, int window, void (*func)(void *ctx, int i), void *ctx) {
+	Pipeline *p = calloc(1, sizeof(Pipeline));
+	p->n = n;
+	p->window = window;
+	p->func = func;
+	p->ctx = ctx;
+#ifdef HAVE_THREADS
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	int err = pthread_create(&p->thread, NULL, producer, p);
+	if (err)
+		error("pthread_create: %s", strerror(err));
+#endif
+	return p;
+}
+
+void pipeline_wait(Pipeline *p, int i) {
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&p->mutex);
+	p->consumer = i;
+	pthread_cond_broadcast(&p->cond);
+	while (p->done <= i)
+		pthread_cond_wait(&p->cond, &p->mutex);
+	pthread_mutex_unlock(&p->mutex);
+#else
+	// Without threads, items are processed on demand.
+	while (p->done <= i)
+		p->func(p->ctx, p->done++);
+#endif
+}
+
+void pipeline_finish(Pipeline *p) {
+#ifdef HAVE_THREADS
+	pthread_mutex_lock(&p->mutex);
+	p->stop = true;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->thread, NULL);
+	pthread_mutex_destroy(&p->mutex);
+	pthread_cond_destroy(&p->cond);
+#endif
+	free(p);
+}
+
+int nr_cpus(void) {
+#if !defined(HAVE_THREADS)
+	return 1;
+#elif defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+#endif
+}
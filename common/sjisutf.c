@@ -18,6 +18,8 @@
 #include "common.h"
 #include "s2utbl.h"
 #include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <uchar.h>
@@ -194,7 +196,9 @@ static int unicode_to_sjis(int u) {
 	if (u > 0xffff)
 		return 0;
 
-	static uint16_t *u2s = NULL;
+	// The table is built on first use, possibly by several threads at once.
+	static _Atomic(uint16_t *) u2s_table = NULL;
+	uint16_t *u2s = atomic_load(&u2s_table);
 	if (!u2s) {
 		// Create a reverse lookup table from s2u.
 		u2s = calloc(0x10000, sizeof(uint16_t));
@@ -207,6 +211,11 @@ static int unicode_to_sjis(int u) {
 					u2s[u] = b1 << 8 | b2;
 			}
 		}
+		uint16_t *expected = NULL;
+		if (!atomic_compare_exchange_strong(&u2s_table, &expected, u2s)) {
+			free(u2s);
+			u2s = expected;
+		}
 	}
 	return u2s[u];
 }
@@ -215,10 +224,11 @@ bool is_valid_sjis(uint8_t c1, uint8_t c2) {
 	return is_sjis_byte1(c1) && is_sjis_byte2(c2) && s2u[c1 - 0x80][c2 - 0x40];
 }
 
-char *sjis2utf_sub(const char *str, int substitution_char) {
+static char *sjis2utf_core(const char *str, int substitution_char, const char **invalid) {
 	const uint8_t *src = (uint8_t *)str;
 	uint8_t *dst = malloc(strlen(str) * 3 + 1);
 	uint8_t *dstp = dst;
+	ptrdiff_t invalid_offset = -1;
 
 	while (*src) {
 		if (*src <= 0x7f) {
@@ -236,6 +246,8 @@ char *sjis2utf_sub(const char *str, int substitution_char) {
 		} else {
 			if (substitution_char < 0)
 				error("Invalid SJIS byte sequence %02x %02x", src[0], src[1]);
+			if (invalid_offset < 0)
+				invalid_offset = dstp - dst;
 			c = substitution_char;
 			src++;
 		}
@@ -252,20 +264,36 @@ char *sjis2utf_sub(const char *str, int substitution_char) {
 		}
 	}
 	*dstp = '\0';
+	if (!invalid)
+		return (char *)dst;
+
+	// Give back the unused part of the buffer, which is sized for the worst case.
+	dst = realloc(dst, dstp - dst + 1);
+	*invalid = invalid_offset < 0 ? NULL : (char *)dst + invalid_offset;
 	return (char *)dst;
 }
 
-char *utf2sjis_sub(const char *str, int substitution_char) {
-	const uint8_t *src = (uint8_t *)str;
-	uint8_t *dst = malloc(strlen(str) + 1);
+char *sjis2utf_sub(const char *str, int substitution_char) {
+	return sjis2utf_core(str, substitution_char, NULL);
+}
+
+char *sjis2utf_checked(const char *str, const char **invalid) {
+	return sjis2utf_core(str, 0xfffd, invalid);
+}
+
+// If a character cannot be converted and substitution_char is negative, its
+// position is stored in *invalid and -1 is returned, or if invalid is NULL, the
+// program exits with an error.
+static int utf2sjis_range(const uint8_t *src, const uint8_t *end, uint8_t *dst, int substitution_char, bool compact, const char **invalid) {
 	uint8_t *dstp = dst;
 
-	while (*src) {
+	while (src < end) {
 		if (*src <= 0x7f) {
 			*dstp++ = *src++;
 			continue;
 		}
 
+		const uint8_t *top = src;
 		int u;
 		if (*src <= 0xdf) {
 			u = (src[0] & 0x1f) << 6 | (src[1] & 0x3f);
@@ -274,8 +302,12 @@ char *utf2sjis_sub(const char *str, int substitution_char) {
 			u = (src[0] & 0xf) << 12 | (src[1] & 0x3f) << 6 | (src[2] & 0x3f);
 			src += 3;
 		} else {
-			if (substitution_char < 0)
-				error("Unsupported UTF-8 sequence");
+			if (substitution_char < 0) {
+				if (!invalid)
+					error("Unsupported UTF-8 sequence");
+				*invalid = (const char *)top;
+				return -1;
+			}
 			*dstp++ = substitution_char;
 			do src++; while ((*src & 0xc0) == 0x80);
 			continue;
@@ -285,18 +317,35 @@ char *utf2sjis_sub(const char *str, int substitution_char) {
 			*dstp++ = u - 0xff60 + 0xa0;
 		} else {
 			int c = unicode_to_sjis(u);
-			if (c) {
+			uint8_t hk = compact && c ? compact_sjis(c >> 8, c & 0xff) : 0;
+			if (hk) {
+				*dstp++ = hk;
+			} else if (c) {
 				*dstp++ = c >> 8;
 				*dstp++ = c & 0xff;
 			} else {
-				if (substitution_char < 0)
-					error("Codepoint U+%04X cannot be converted to Shift_JIS", u);
+				if (substitution_char < 0) {
+					if (!invalid)
+						error("Codepoint U+%04X cannot be converted to Shift_JIS", u);
+					*invalid = (const char *)top;
+					return -1;
+				}
 				*dstp++ = substitution_char;
 			}
 		}
 	}
-	*dstp = '\0';
-	return (char*)dst;
+	return dstp - dst;
+}
+
+char *utf2sjis_sub(const char *str, int substitution_char) {
+	size_t len = strlen(str);
+	uint8_t *dst = malloc(len + 1);
+	dst[utf2sjis_range((const uint8_t *)str, (const uint8_t *)str + len, dst, substitution_char, false, NULL)] = '\0';
+	return (char *)dst;
+}
+
+int utf2sjis_to(const char *str, int len, uint8_t *dst, bool compact, const char **invalid) {
+	return utf2sjis_range((const uint8_t *)str, (const uint8_t *)str + len, dst, -1, compact, invalid);
 }
 
 const char *validate_utf8(const char *s) {
@@ -446,12 +495,12 @@ static int unicode_to_msx(uint16_t u, const char16_t table[256]) {
 	return -1;
 }
 
-static char *utf2msx(const char *str, const char16_t table[256], int *out_len) {
-	const uint8_t *src = (uint8_t *)str;
-	uint8_t *dst = malloc(strlen(str) + 1);
+// See utf2sjis_range() for `invalid`.
+static int utf2msx_range(const uint8_t *src, const uint8_t *end, uint8_t *dst, const char16_t table[256], const char **invalid) {
 	uint8_t *dstp = dst;
 
-	while (*src) {
+	while (src < end) {
+		const uint8_t *top = src;
 		int u;
 		if (*src <= 0x7f) {
 			u = *src++;
@@ -462,7 +511,10 @@ static char *utf2msx(const char *str, const char16_t table[256], int *out_len) {
 			u = (src[0] & 0xf) << 12 | (src[1] & 0x3f) << 6 | (src[2] & 0x3f);
 			src += 3;
 		} else {
-			error("Unsupported UTF-8 sequence");
+			if (!invalid)
+				error("Unsupported UTF-8 sequence");
+			*invalid = (const char *)top;
+			return -1;
 		}
 
 		// Try splitting
@@ -493,11 +545,21 @@ static char *utf2msx(const char *str, const char16_t table[256], int *out_len) {
 				continue;
 			}
 		}
-		error("Codepoint U+%04X cannot be converted to MSX", u);
+		if (!invalid)
+			error("Codepoint U+%04X cannot be converted to MSX", u);
+		*invalid = (const char *)top;
+		return -1;
 	}
-	*dstp = '\0';
+	return dstp - dst;
+}
+
+static char *utf2msx(const char *str, const char16_t table[256], int *out_len) {
+	size_t len = strlen(str);
+	uint8_t *dst = malloc(len + 1);
+	int n = utf2msx_range((const uint8_t *)str, (const uint8_t *)str + len, dst, table, NULL);
+	dst[n] = '\0';
 	if (out_len)
-		*out_len = dstp - dst;
+		*out_len = n;
 	return (char *)dst;
 }
 
@@ -505,6 +567,10 @@ char *utf2msx_msg(const char *str, int *out_len) {
 	return utf2msx(str, msx_msg_table, out_len);
 }
 
+int utf2msx_msg_to(const char *str, int len, uint8_t *dst, const char **invalid) {
+	return utf2msx_range((const uint8_t *)str, (const uint8_t *)str + len, dst, msx_msg_table, invalid);
+}
+
 char *utf2msx_data(const char *str) {
 	return utf2msx(str, msx_ag00_table, NULL);
 }
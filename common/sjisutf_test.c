@@ -110,7 +110,58 @@ static void test_compaction(void) {
 	}
 }
 
+static void test_utf2sjis_to(void) {
+	// "a" + HIRAGANA A + IDEOGRAPHIC SPACE + HALFWIDTH KATAKANA A
+	const char *utf8 = "a\xe3\x81\x82\xe3\x80\x80\xef\xbd\xb1";
+	uint8_t buf[16];
+	int len = utf2sjis_to(utf8, strlen(utf8), buf, false, NULL);
+	if (len != 6 || memcmp(buf, "a\x82\xa0\x81\x40\xb1", 6)) {
+		printf("[FAIL] utf2sjis_to: unexpected output (len=%d)\n", len);
+		exit(1);
+	}
+	len = utf2sjis_to(utf8, strlen(utf8), buf, true, NULL);
+	if (len != 4 || memcmp(buf, "a\xb1 \xb1", 4)) {
+		printf("[FAIL] utf2sjis_to (compact): unexpected output (len=%d)\n", len);
+		exit(1);
+	}
+	// Only the given range is converted.
+	len = utf2sjis_to(utf8, 4, buf, false, NULL);
+	if (len != 3 || memcmp(buf, "a\x82\xa0", 3)) {
+		printf("[FAIL] utf2sjis_to (partial): unexpected output (len=%d)\n", len);
+		exit(1);
+	}
+	// "a" + GRINNING FACE + HIRAGANA A, "a" + CJK U+4E02 (not in Shift_JIS)
+	const char *bad[] = { "a\xf0\x9f\x98\x80\xe3\x81\x82", "a\xe4\xb8\x82" };
+	for (int i = 0; i < 2; i++) {
+		const char *invalid = NULL;
+		len = utf2sjis_to(bad[i], strlen(bad[i]), buf, false, &invalid);
+		if (len != -1 || invalid != bad[i] + 1) {
+			printf("[FAIL] utf2sjis_to (invalid): unexpected result (len=%d)\n", len);
+			exit(1);
+		}
+	}
+}
+
+static void test_sjis2utf_checked(void) {
+	const char *err;
+	char *utf = sjis2utf_checked("a\x82\xa0" "b", &err);
+	if (strcmp(utf, "a\xe3\x81\x82" "b") || err) {
+		printf("[FAIL] sjis2utf_checked: valid input\n");
+		exit(1);
+	}
+	free(utf);
+	// 0x85 0x40 is not assigned.
+	utf = sjis2utf_checked("a\x82\xa0\x85\x40\x85\x40", &err);
+	if (!err || err - utf != 4 || strncmp(err, "\xef\xbf\xbd", 3)) {
+		printf("[FAIL] sjis2utf_checked: invalid position\n");
+		exit(1);
+	}
+	free(utf);
+}
+
 void sjisutf_test(void) {
 	test_compaction();
 	test_msx();
+	test_utf2sjis_to();
+	test_sjis2utf_checked();
 }
@@ -99,6 +99,30 @@ int checked_open(const char *path_utf8, int oflag) {
 	return fd;
 }
 
+void checked_rename(const char *from_utf8, const char *to_utf8) {
+#ifdef _WIN32
+	wchar_t wfrom[PATH_MAX + 1], wto[PATH_MAX + 1];
+	if (!MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, from_utf8, -1, wfrom, PATH_MAX + 1))
+		error("MultiByteToWideChar(\"%s\") failed with error code 0x%x", from_utf8, GetLastError());
+	if (!MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, to_utf8, -1, wto, PATH_MAX + 1))
+		error("MultiByteToWideChar(\"%s\") failed with error code 0x%x", to_utf8, GetLastError());
+	// rename() on Windows fails if the destination exists.
+	if (!MoveFileExW(wfrom, wto, MOVEFILE_REPLACE_EXISTING))
+		error("cannot rename %s to %s: error code 0x%x", from_utf8, to_utf8, GetLastError());
+#else
+	if (rename(from_utf8, to_utf8) != 0)
+		error("cannot rename %s to %s: %s", from_utf8, to_utf8, strerror(errno));
+#endif
+}
+
+MappedFile *map_file(const char *path_utf8) {
+	MappedFile *mf;
+	int err = try_map_file(path_utf8, &mf);
+	if (err)
+		error("cannot open %s: %s", path_utf8, strerror(err));
+	return mf;
+}
+
 static inline bool is_path_separator(char c) {
 #ifdef _WIN32
 	return c == '/' || c == '\\';
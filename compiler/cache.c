@@ -0,0 +1,280 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Incremental build cache. For each page, the cache file stores the hash of
+// its source file, the compiled code, and the symbol table accesses made by
+// the page. A page is reused if its source is unchanged and replaying the
+// accesses against the current symbol table gives the same results.
+
+#include "sys3c.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_VERSION 1
+
+typedef struct {
+	bool valid;
+	uint64_t source_hash;
+	uint32_t volume_bits;
+	bool no_default_label;
+	const uint8_t *code;
+	int code_len;
+	LineMap *linemap;
+	Vector *symbol_accesses;
+} CacheEntry;
+
+struct BuildCache {
+	uint64_t fingerprint;
+	int nr_pages;
+	CacheEntry *entries;
+};
+
+// 64-bit FNV-1a
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+
+uint64_t hash_data(const void *data, size_t len) {
+	return fnv1a(FNV_OFFSET_BASIS, data, len);
+}
+
+static uint64_t hash_int(uint64_t h, int n) {
+	uint32_t v = n;
+	return fnv1a(h, &v, sizeof(v));
+}
+
+static uint64_t hash_string(uint64_t h, const char *s) {
+	return fnv1a(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static uint64_t hash_strings(uint64_t h, Vector *v) {
+	h = hash_int(h, v ? v->len : -1);
+	for (int i = 0; v && i < v->len; i++)
+		h = hash_string(h, v->data[i]);
+	return h;
+}
+
+uint64_t build_fingerprint(Vector *src_paths, Vector *verbs, Vector *objs) {
+	uint64_t h = hash_string(FNV_OFFSET_BASIS, VERSION);
+	h = hash_int(h, CACHE_VERSION);
+	h = hash_int(h, config.sys_ver);
+	h = hash_int(h, config.game_id);
+	h = hash_int(h, config.output_encoding);
+	h = hash_int(h, config.utf8);
+	h = hash_int(h, config.allow_ascii);
+	h = hash_int(h, config.rev_marker);
+	h = hash_int(h, config.sys0dc_offby1_error);
+	h = hash_int(h, config.debug);
+	h = hash_int(h, config.optimize);
+	// File names are used by the '#' operator.
+	h = hash_int(h, src_paths->len);
+	for (int i = 0; i < src_paths->len; i++)
+		h = hash_string(h, src_paths->data[i] ? basename_utf8(src_paths->data[i]) : NULL);
+	h = hash_strings(h, verbs);
+	h = hash_strings(h, objs);
+	return h;
+}
+
+typedef struct {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool error;
+} Reader;
+
+static const uint8_t *read_bytes(Reader *r, uint32_t len) {
+	if (r->error || len > r->end - r->p) {
+		r->error = true;
+		return NULL;
+	}
+	const uint8_t *p = r->p;
+	r->p += len;
+	return p;
+}
+
+static uint32_t read_dword(Reader *r) {
+	const uint8_t *p = read_bytes(r, 4);
+	return p ? le32(p) : 0;
+}
+
+static uint64_t read_qword(Reader *r) {
+	uint64_t lo = read_dword(r);
+	uint64_t hi = read_dword(r);
+	return lo | hi << 32;
+}
+
+static char *read_string(Reader *r) {
+	uint32_t len = read_dword(r);
+	const uint8_t *p = read_bytes(r, len);
+	return p ? strndup_((const char *)p, len) : NULL;
+}
+
+static bool read_entry(Reader *r, CacheEntry *e) {
+	e->valid = read_dword(r);
+	if (!e->valid)
+		return !r->error;
+	e->source_hash = read_qword(r);
+	e->volume_bits = read_dword(r);
+	e->no_default_label = read_dword(r);
+	e->code_len = read_dword(r);
+	e->code = read_bytes(r, e->code_len);
+
+	if (config.debug) {
+		uint32_t nr_lines = read_dword(r);
+		if (nr_lines > (r->end - r->p) / 8) {
+			r->error = true;
+			return false;
+		}
+		e->linemap = new_linemap(nr_lines);
+		for (uint32_t i = 0; i < nr_lines; i++) {
+			LineInfo *li = &e->linemap->entries[i];
+			li->line = read_dword(r);
+			li->addr = read_dword(r);
+		}
+		e->linemap->len = nr_lines;
+	}
+
+	uint32_t nr_accesses = read_dword(r);
+	e->symbol_accesses = new_vec();
+	for (uint32_t i = 0; i < nr_accesses && !r->error; i++) {
+		SymbolAccess *a = calloc(1, sizeof(SymbolAccess));
+		a->name = read_string(r);
+		a->define = read_dword(r);
+		a->type = read_dword(r);
+		a->value = read_dword(r);
+		vec_push(e->symbol_accesses, a);
+	}
+	return !r->error;
+}
+
+BuildCache *load_build_cache(const char *path, uint64_t fingerprint, int nr_pages) {
+	BuildCache *cache = calloc(1, sizeof(BuildCache));
+	cache->fingerprint = fingerprint;
+	cache->nr_pages = nr_pages;
+	cache->entries = calloc(nr_pages, sizeof(CacheEntry));
+
+	MappedFile *mf;
+	if (try_map_file(path, &mf) != 0)
+		return cache;
+	Reader r = { mf->data, mf->data + mf->size, false };
+	const uint8_t *magic = read_bytes(&r, 4);
+	if (!magic || memcmp(magic, "S3CC", 4) || read_qword(&r) != fingerprint || read_dword(&r) != nr_pages)
+		return cache;
+	for (int i = 0; i < nr_pages; i++) {
+		if (!read_entry(&r, &cache->entries[i])) {
+			// Broken cache; ignore it.
+			memset(cache->entries, 0, nr_pages * sizeof(CacheEntry));
+			break;
+		}
+	}
+	// The mapping is kept since entries point into it.
+	return cache;
+}
+
+bool build_cache_has(BuildCache *cache, int page, uint64_t source_hash) {
+	CacheEntry *e = &cache->entries[page];
+	return e->valid && e->source_hash == source_hash;
+}
+
+Sco *build_cache_lookup(BuildCache *cache, Compiler *comp, int page, uint64_t source_hash) {
+	CacheEntry *e = &cache->entries[page];
+	if (!build_cache_has(cache, page, source_hash) || !replay_symbols(comp, e->symbol_accesses))
+		return NULL;
+
+	Sco *sco = &comp->scos[page];
+	sco->buf = new_buf_sized(e->code_len);
+	emit_bytes(sco->buf, e->code, e->code_len);
+	sco->volume_bits = e->volume_bits;
+	sco->linemap = e->linemap;
+	sco->symbol_accesses = e->symbol_accesses;
+	sco->no_default_label = e->no_default_label;
+	if (sco->no_default_label)
+		fprintf(stderr, "%s: no default label\n", (char*)comp->src_paths->data[page]);
+	return sco;
+}
+
+void build_cache_store(BuildCache *cache, int page, uint64_t source_hash, Sco *sco) {
+	CacheEntry *e = &cache->entries[page];
+	e->valid = true;
+	e->source_hash = source_hash;
+	e->volume_bits = sco->volume_bits;
+	e->no_default_label = sco->no_default_label;
+	e->code = sco->buf->buf;
+	e->code_len = sco->buf->len;
+	e->linemap = sco->linemap;
+	e->symbol_accesses = sco->symbol_accesses;
+}
+
+static void emit_qword(Buffer *b, uint64_t v) {
+	emit_dword(b, v & 0xffffffff);
+	emit_dword(b, v >> 32);
+}
+
+static void emit_sized_string(Buffer *b, const char *s) {
+	emit_dword(b, strlen(s));
+	emit_string(b, s);
+}
+
+void save_build_cache(BuildCache *cache, const char *path) {
+	Buffer *b = new_buf();
+	emit_string(b, "S3CC");
+	emit_qword(b, cache->fingerprint);
+	emit_dword(b, cache->nr_pages);
+	for (int i = 0; i < cache->nr_pages; i++) {
+		CacheEntry *e = &cache->entries[i];
+		emit_dword(b, e->valid);
+		if (!e->valid)
+			continue;
+		emit_qword(b, e->source_hash);
+		emit_dword(b, e->volume_bits);
+		emit_dword(b, e->no_default_label);
+		emit_dword(b, e->code_len);
+		emit_bytes(b, e->code, e->code_len);
+		if (config.debug) {
+			emit_dword(b, e->linemap->len);
+			for (int j = 0; j < e->linemap->len; j++) {
+				LineInfo *li = &e->linemap->entries[j];
+				emit_dword(b, li->line);
+				emit_dword(b, li->addr);
+			}
+		}
+		emit_dword(b, e->symbol_accesses->len);
+		for (int j = 0; j < e->symbol_accesses->len; j++) {
+			SymbolAccess *a = e->symbol_accesses->data[j];
+			emit_sized_string(b, a->name);
+			emit_dword(b, a->define);
+			emit_dword(b, a->type);
+			emit_dword(b, a->value);
+		}
+	}
+
+	char tmp_path[PATH_MAX + 5];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *fp = checked_fopen(tmp_path, "wb");
+	if (fwrite(b->buf, b->len, 1, fp) != 1 || fclose(fp) != 0)
+		error("%s: %s", tmp_path, strerror(errno));
+	checked_rename(tmp_path, path);
+}
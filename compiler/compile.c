@@ -23,35 +23,111 @@
 
 #define DUPLICATE 1000
 
-static Compiler *compiler;
-static const char *menu_item_start;
+// Compilation state of the current page. These are thread-local so that
+// try_compile() can run on multiple threads.
+static _Thread_local Compiler *compiler;
+static _Thread_local const char *menu_item_start;
 
-typedef enum {
-	VARIABLE,
-	CONST,
-} SymbolType;
-
-typedef struct {
-	SymbolType type;
-	int value;  // variable index or constant value
-} Symbol;
-
-static Symbol *new_symbol(SymbolType type, int value) {
-	Symbol *s = calloc(1, sizeof(Symbol));
+static Symbol *new_symbol(Compiler *comp, SymbolType type, int value) {
+	Symbol *s = arena_alloc(comp->arena, sizeof(Symbol));
 	s->type = type;
 	s->value = value;
 	return s;
 }
 
-static Map *labels;
+static _Thread_local HashMap *labels;
+static _Thread_local Vector *label_list;  // labels in order of first appearance
+
+static _Thread_local Buffer *out;
+static _Thread_local LineMap *linemap;
+static _Thread_local Vector *symbol_accesses;  // NULL unless record_symbols
+static _Thread_local HashMap *accessed_symbols;
+static _Thread_local Vector *references;  // NULL unless record_references
+static _Thread_local CodeMap *code_map;  // NULL unless config.optimize
+static _Thread_local Arena *sco_arena;
+
+// Abandons a speculative compilation (see try_compile()) that is about to
+// read or modify the symbol table in a way that depends on the other pages.
+static void leave_speculation(void) {
+	if (speculation)
+		longjmp(*speculation, 1);
+}
+
+static void record_access(const char *name, bool define, Symbol *sym) {
+	SymbolAccess *a = arena_alloc(sco_arena, sizeof(SymbolAccess));
+	a->name = arena_strdup(sco_arena, name);
+	a->define = define;
+	a->type = sym ? (int)sym->type : -1;
+	a->value = sym ? sym->value : 0;
+	vec_push(symbol_accesses, a);
+	hash_put(accessed_symbols, name, a);
+}
+
+static void record_command(void) {
+	CodeCommand *c = arena_alloc(page_arena, sizeof(CodeCommand));
+	c->addr = current_address(out);
+	c->kind = CODE_OTHER;
+	vec_push(code_map->commands, c);
+}
+
+// Sets the kind of the command being compiled.
+static void set_command_kind(CodeKind kind) {
+	if (code_map)
+		((CodeCommand *)code_map->commands->data[code_map->commands->len - 1])->kind = kind;
+}
 
-static Buffer *out;
+// Records that the word at addr holds a code address.
+static void record_slot(int addr) {
+	if (code_map)
+		vec_push(code_map->slots, (void *)(intptr_t)addr);
+}
 
-static int lookup_var(char *var, bool create) {
-	Symbol *sym = hash_get(compiler->symbols, var);
+static void record_reference(ReferenceKind kind, bool define, const char *name, const char *pos, int page) {
+	if (!references)
+		return;
+	Reference *r = arena_alloc(sco_arena, sizeof(Reference));
+	r->kind = kind;
+	r->define = define;
+	r->name = arena_strdup(sco_arena, name);
+	r->page = page;
+	r->offset = pos - input_buf;
+	r->length = strlen(name);
+	vec_push(references, r);
+}
+
+// Returns the atom by which `name` is stored in the symbol table. This differs
+// from `name` if the page used the name before it was defined.
+static const char *symbol_key(const char *name) {
+	const char *key = intern_lookup(compiler->atoms, name, strlen(name));
+	return key ? key : name;
+}
+
+static Symbol *get_symbol(const char *name) {
+	Symbol *sym = hash_get(compiler->symbols, name);
+	if (!sym) {
+		name = symbol_key(name);
+		sym = hash_get(compiler->symbols, name);
+	}
+	if (symbol_accesses && !hash_get(accessed_symbols, name))
+		record_access(name, false, sym);
+	return sym;
+}
+
+// Returns the atom by which the symbol is stored in the symbol table.
+static const char *put_symbol(const char *name, Symbol *sym) {
+	const char *key = intern(compiler->atoms, name, strlen(name));
+	hash_put(compiler->symbols, key, sym);
+	if (symbol_accesses)
+		record_access(key, true, sym);
+	return key;
+}
+
+static int lookup_var(const char *var, bool create) {
+	Symbol *sym = get_symbol(var);
 	if (sym) {
 		switch (sym->type) {
 		case VARIABLE:
+			record_reference(REF_SYMBOL, false, var, input - strlen(var), 0);
 			return sym->value;
 		case CONST:
 			if (create)
@@ -60,146 +136,253 @@ static int lookup_var(char *var, bool create) {
 		}
 	}
 
+	// The variable may be created by a preceding page.
+	leave_speculation();
 	if (!create)
 		return -1;
-	sym = new_symbol(VARIABLE, compiler->variables->len);
-	vec_push(compiler->variables, var);
-	hash_put(compiler->symbols, var, sym);
+	sym = new_symbol(compiler, VARIABLE, compiler->variables->len);
+	vec_push(compiler->variables, (char *)put_symbol(var, sym));
+	record_reference(REF_SYMBOL, true, var, input - strlen(var), 0);
 	return sym->value;
 }
 
-static void expr(void);
-static void expr_equal(void);
 static void commands(void);
 
-static void variable(char *id, bool create) {
+static int variable_index(const char *id, bool create) {
 	int var = lookup_var(id, create);
 	if (var < 0)
 		error_at(input - strlen(id), "Undefined variable '%s'", id);
-	emit_var(out, var);
+	if (var > 0x3fff)
+		error_at(input - strlen(id), "Too many variables");
+	return var;
+}
+
+static void variable(const char *id, bool create) {
+	emit_var(out, variable_index(id, create));
+}
+
+// Expressions are parsed into a tree, and then emitted in reverse Polish
+// notation. With config.optimize, constant subexpressions are folded while the
+// tree is built.
+typedef enum {
+	EXPR_NUMBER,
+	EXPR_VAR,
+	EXPR_BINOP,
+	EXPR_SEQ,  // '$': both operands are emitted without an operator
+} ExprKind;
+
+typedef struct Expr {
+	ExprKind kind;
+	int value;  // number or variable index
+	char op;    // EXPR_BINOP: the operator in the source
+	struct Expr *lhs, *rhs;
+} Expr;
+
+static Expr *new_expr(ExprKind kind, int value, Expr *lhs, Expr *rhs) {
+	Expr *e = arena_alloc(page_arena, sizeof(Expr));
+	e->kind = kind;
+	e->value = value;
+	e->lhs = lhs;
+	e->rhs = rhs;
+	return e;
+}
+
+// Computes `a op b` as the interpreter does. Interpreters differ in how they
+// handle overflow, underflow and division by zero, so returns false in those
+// cases, leaving the operation to the runtime.
+static bool eval_binop(char op, int a, int b, int *result) {
+	if (a > 0xffff || b > 0xffff)
+		return false;
+	// Computed in 64 bits, since a product of two 16-bit values overflows int.
+	int64_t r;
+	switch (op) {
+	case '*': r = (int64_t)a * b; break;
+	case '/': if (!b) return false; r = a / b; break;
+	case '+': r = (int64_t)a + b; break;
+	case '-': r = (int64_t)a - b; break;
+	case '=': r = a == b; break;
+	case '<': r = a < b; break;
+	case '>': r = a > b; break;
+	case '\\': r = a != b; break;
+	default: return false;
+	}
+	if (r < 0 || r > 0xffff)
+		return false;
+	*result = r;
+	return true;
+}
+
+static Expr *binop(char op, Expr *lhs, Expr *rhs) {
+	int val;
+	if (config.optimize && lhs->kind == EXPR_NUMBER && rhs->kind == EXPR_NUMBER &&
+		eval_binop(op, lhs->value, rhs->value, &val))
+		return new_expr(EXPR_NUMBER, val, NULL, NULL);
+	Expr *e = new_expr(EXPR_BINOP, 0, lhs, rhs);
+	e->op = op;
+	return e;
 }
 
-static void number(void) {
-	emit_number(out, get_number());
+// Returns false if `e` is not a constant expression.
+static bool eval_expr(Expr *e, int *result) {
+	int a, b;
+	switch (e->kind) {
+	case EXPR_NUMBER:
+		*result = e->value;
+		return true;
+	case EXPR_BINOP:
+		return eval_expr(e->lhs, &a) && eval_expr(e->rhs, &b) && eval_binop(e->op, a, b, result);
+	default:
+		return false;
+	}
+}
+
+static uint8_t opcode(char op) {
+	switch (op) {
+	case '*': return config.sys_ver == SYSTEM1 ? OP_DIV : OP_MUL;
+	case '/': return OP_DIV;
+	case '+': return OP_ADD;
+	case '-': return OP_SUB;
+	case '=': return OP_EQ;
+	case '<': return OP_LT;
+	case '>': return OP_GT;
+	case '\\': return OP_NE;
+	}
+	error("BUG: unknown operator %c", op);
+}
+
+static void emit_expr(Expr *e) {
+	switch (e->kind) {
+	case EXPR_NUMBER:
+		emit_number(out, e->value);
+		break;
+	case EXPR_VAR:
+		emit_var(out, e->value);
+		break;
+	case EXPR_BINOP:
+		emit_expr(e->lhs);
+		emit_expr(e->rhs);
+		emit(out, opcode(e->op));
+		break;
+	case EXPR_SEQ:
+		emit_expr(e->lhs);
+		emit_expr(e->rhs);
+		break;
+	}
 }
 
+static Expr *expr_equal(void);
+
 // prim ::= '(' equal ')' | number | '#' filename | const | var
-static void expr_prim(void) {
+static Expr *expr_prim(void) {
 	if (consume('(')) {
-		expr_equal();
+		Expr *e = expr_equal();
 		expect(')');
+		return e;
 	} else if (isdigit(next_char())) {
-		number();
+		return new_expr(EXPR_NUMBER, get_number(), NULL, NULL);
 	} else if (consume('#')) {
 		const char *top = input;
-		char *fname = get_filename();
+		const char *fname = get_filename();
 		for (int i = 0; i < compiler->src_paths->len; i++) {
 			const char *path = compiler->src_paths->data[i];
 			if (path && !strcasecmp(fname, basename_utf8(path))) {
-				emit_number(out, i);
-				return;
+				record_reference(REF_PAGE, false, fname, input - strlen(fname), i);
+				return new_expr(EXPR_NUMBER, i, NULL, NULL);
 			}
 		}
 		error_at(top, "reference to unknown source file: '%s'", fname);
 	} else {
-		char *id = get_identifier();
-		if (!strcmp(id, "__LINE__")) {
-			emit_number(out, input_line);
-		} else {
-			Symbol *sym = hash_get(compiler->symbols, id);
-			if (sym && sym->type == CONST)
-				emit_number(out, sym->value);
-			else
-				variable(id, false);
+		const char *id = get_identifier();
+		if (!strcmp(id, "__LINE__"))
+			return new_expr(EXPR_NUMBER, input_line, NULL, NULL);
+		Symbol *sym = get_symbol(id);
+		if (sym && sym->type == CONST) {
+			record_reference(REF_SYMBOL, false, id, input - strlen(id), 0);
+			return new_expr(EXPR_NUMBER, sym->value, NULL, NULL);
 		}
+		return new_expr(EXPR_VAR, variable_index(id, false), NULL, NULL);
 	}
 }
 
 // mul ::= prim ('*' prim | '/' prim | '%' prim)*
-static void expr_mul(void) {
-	expr_prim();
+static Expr *expr_mul(void) {
+	Expr *e = expr_prim();
 	for (;;) {
 		if (consume('*')) {
-			expr_prim();
-			emit(out, config.sys_ver == SYSTEM1 ? OP_DIV : OP_MUL);
+			e = binop('*', e, expr_prim());
 		} else if (consume('/')) {
 			if (config.sys_ver == SYSTEM1)
 				error_at(input - 1, "division is not supported in System 1");
-			expr_prim();
-			emit(out, OP_DIV);
+			e = binop('/', e, expr_prim());
 		} else {
-			break;
+			return e;
 		}
 	}
 }
 
 // add ::= mul ('+' mul | '-' mul)*
-static void expr_add(void) {
-	expr_mul();
+static Expr *expr_add(void) {
+	Expr *e = expr_mul();
 	for (;;) {
-		if (consume('+')) {
-			expr_mul();
-			emit(out, OP_ADD);
-		} else if (consume('-')) {
-			expr_mul();
-			emit(out, OP_SUB);
-		} else {
-			break;
-		}
+		if (consume('+'))
+			e = binop('+', e, expr_mul());
+		else if (consume('-'))
+			e = binop('-', e, expr_mul());
+		else
+			return e;
 	}
 }
 
 // compare ::= add ('<' add | '>' add | '<=' add | '>=' add)*
-static void expr_compare(void) {
-	expr_add();
+static Expr *expr_compare(void) {
+	Expr *e = expr_add();
 	for (;;) {
-		int op = 0;
-		if (consume('<')) {
-			op = OP_LT;
-		} else if (consume('>')) {
-			op = OP_GT;
-		}
-		if (!op)
-			break;
-		expr_add();
-		emit(out, op);
+		if (consume('<'))
+			e = binop('<', e, expr_add());
+		else if (consume('>'))
+			e = binop('>', e, expr_add());
+		else
+			return e;
 	}
 }
 
 // equal ::= compare ('=' compare | '\' compare | '$' compare)*
-static void expr_equal(void) {
-	expr_compare();
+static Expr *expr_equal(void) {
+	Expr *e = expr_compare();
 	for (;;) {
-		if (consume('=')) {
-			expr_compare();
-			emit(out, OP_EQ);
-		} else if (consume('\\')) {
-			expr_compare();
-			emit(out, OP_NE);
-		} else if (consume('$')) {
-			expr_compare();
-		} else {
-			break;
-		}
+		if (consume('='))
+			e = binop('=', e, expr_compare());
+		else if (consume('\\'))
+			e = binop('\\', e, expr_compare());
+		else if (consume('$'))
+			e = new_expr(EXPR_SEQ, 0, e, expr_compare());
+		else
+			return e;
 	}
 }
 
 // expr ::= equal
 static void expr(void) {
-	expr_equal();
+	emit_expr(expr_equal());
 	emit(out, OP_END);
 }
 
 // 'const' 'word' identifier '=' constexpr (',' identifier '=' constexpr)* ':'
 static void define_const(void) {
+	leave_speculation();
 	if (!consume_keyword("word"))
 		error_at(input, "unknown const type");
 	do {
 		const char *top = input;
-		char *id = get_identifier();
+		const char *id = get_identifier();
+		const char *id_pos = input - strlen(id);
 		consume('=');
-		int val = get_number();  // TODO: Allow expressions
-		Symbol *sym = hash_get(compiler->symbols, id);
+		skip_whitespaces();
+		const char *expr_top = input;
+		int val;
+		if (!eval_expr(expr_equal(), &val))
+			error_at(expr_top, "constant expression expected");
+		Symbol *sym = get_symbol(id);
 		if (sym) {
 			switch (sym->type) {
 			case VARIABLE:
@@ -208,35 +391,41 @@ static void define_const(void) {
 				error_at(top, "constant '%s' redefined", id);
 			}
 		}
-		hash_put(compiler->symbols, id, new_symbol(CONST, val));
+		put_symbol(id, new_symbol(compiler, CONST, val));
+		record_reference(REF_SYMBOL, true, id, id_pos, 0);
 	} while (consume(','));
 	expect(':');
 }
 
-static Label *lookup_label(char *id) {
-	Label *l = map_get(labels, id);
+static Label *lookup_label(const char *id) {
+	Label *l = hash_get(labels, id);
 	if (!l) {
-		l = calloc(1, sizeof(Label));
+		l = arena_alloc(page_arena, sizeof(Label));
+		l->name = id;
 		l->source_loc = input - strlen(id);
-		map_put(labels, id, l);
+		hash_put(labels, id, l);
+		vec_push(label_list, l);
 	}
 	return l;
 }
 
 static void add_label(void) {
-	char *id = get_label();
+	const char *id = get_label();
 	Label *l = lookup_label(id);
 	if (l->addr)
 		error_at(input - strlen(id), "label '%s' redefined", id);
 	l->addr = current_address(out);
+	record_reference(REF_LABEL, true, id, input - strlen(id), 0);
 
 	while (l->hole_addr)
 		l->hole_addr = swap_word(out, l->hole_addr, l->addr);
 }
 
 static Label *label(void) {
-	char *id = get_label();
+	const char *id = get_label();
 	Label *l = lookup_label(id);
+	record_reference(REF_LABEL, false, id, input - strlen(id), 0);
+	record_slot(current_address(out));
 	if (!l->addr) {
 		emit_word(out, l->hole_addr);
 		l->hole_addr = current_address(out) - 2;
@@ -251,7 +440,7 @@ static int verb_or_obj(Vector *list, HashMap *map, const char *type) {
 	skip_whitespaces();
 	const char *top = input;
 	if (*input == '"') {
-		char *key = get_string();
+		const char *key = get_string();
 		int idx = (intptr_t)hash_get(map, key) - 1;
 		if (idx < 0)
 			error_at(top, "undefined %s: \"%s\"", type, key);
@@ -359,6 +548,8 @@ static void assign(void) {
 
 // conditional ::= '{' expr ':' commands '}'
 static void conditional(void) {
+	if (config.sys_ver != SYSTEM3)
+		set_command_kind(CODE_BRANCH);
 	emit(out, '{');
 	expr();
 	expect(':');
@@ -366,6 +557,7 @@ static void conditional(void) {
 	int hole;
 	if (config.sys_ver == SYSTEM3) {
 		hole = current_address(out);
+		record_slot(hole);
 		emit_word(out, 0);
 	}
 
@@ -381,9 +573,9 @@ static void conditional(void) {
 
 static void pragma(void) {
 	if (consume_keyword("dri_volume")) {
-		char *volumes = get_identifier();
+		const char *volumes = get_identifier();
 		compiler->scos[input_page].volume_bits = 0;
-		for (char *p = volumes; *p; p++) {
+		for (const char *p = volumes; *p; p++) {
 			if (!isalpha(*p))
 				error_at(input - strlen(p), "invalid volume letter '%c'", *p);
 			compiler->scos[input_page].volume_bits |= 1 << (toupper(*p) - 'A' + 1);
@@ -391,7 +583,9 @@ static void pragma(void) {
 		expect(':');
 	} else if (consume_keyword("default_address")) {
 		int address = get_number();
-		Label *l = lookup_label("default");
+		if (code_map)
+			code_map->fixed_entry = true;
+		Label *l = lookup_label(intern(page_atoms, "default", 7));
 		if (l->addr)
 			error_at(input, "label 'default' redefined");
 		l->addr = address;
@@ -405,8 +599,10 @@ static void pragma(void) {
 
 static bool command(void) {
 	skip_whitespaces();
-	if (compiler->dbg_info)
-		debug_line_add(compiler->dbg_info, input_line, current_address(out));
+	if (linemap)
+		debug_line_add(linemap, input_line, current_address(out));
+	if (code_map)
+		record_command();
 
 	const char *command_top = input;
 	int cmd = get_command(out);
@@ -416,6 +612,7 @@ static bool command(void) {
 		return false;
 
 	case '\x1a':  // EOF
+		set_command_kind(CODE_MARKER);
 		emit(out, cmd);
 		break;
 
@@ -442,6 +639,7 @@ static bool command(void) {
 		break;
 
 	case '}':
+		set_command_kind(CODE_MARKER);
 		return false;
 
 	case '*':  // Label
@@ -450,6 +648,7 @@ static bool command(void) {
 		break;
 
 	case '@':  // Label jump
+		set_command_kind(CODE_JUMP);
 		emit(out, cmd);
 		label();
 		expect(':');
@@ -457,14 +656,17 @@ static bool command(void) {
 
 	case '\\': // Label call
 		emit(out, cmd);
-		if (consume('0'))
+		if (consume('0')) {
+			set_command_kind(CODE_RETURN);
 			emit_word(out, 0);  // Return
-		else
+		} else {
 			label();
+		}
 		expect(':');
 		break;
 
 	case '&':  // Page jump
+		set_command_kind(CODE_PAGE_JUMP);
 		emit(out, cmd);
 		expr();
 		expect(':');
@@ -567,8 +769,8 @@ static void commands(void) {
 static void toplevel(void) {
 	if (config.rev_marker && input_page == 0) {
 		skip_whitespaces();
-		if (compiler->dbg_info)
-			debug_line_add(compiler->dbg_info, input_line, current_address(out));
+		if (linemap)
+			debug_line_add(linemap, input_line, current_address(out));
 		emit(out, 'R');
 		emit(out, 'E');
 		emit(out, 'V');
@@ -579,16 +781,17 @@ static void toplevel(void) {
 		error_at(input, "unexpected '%c'", *input);
 }
 
-HashMap *init_verbobj_hash(Vector *list) {
-	HashMap *map = new_string_hash();
+HashMap *init_verbobj_hash(Interner *atoms, Vector *list) {
+	HashMap *map = new_atom_hash();
 	if (!list)
 		return map;
 
 	for (int i = 0; i < list->len; i++) {
+		const char *key = intern(atoms, list->data[i], strlen(list->data[i]));
 		intptr_t val = i;
-		if (hash_get(map, list->data[i]))
+		if (hash_get(map, key))
 			val = DUPLICATE;
-		hash_put(map, list->data[i], (void*)(val + 1));  // +1 to avoid NULL
+		hash_put(map, key, (void*)(val + 1));  // +1 to avoid NULL
 	}
 	return map;
 }
@@ -597,15 +800,19 @@ Compiler *new_compiler(Vector *src_paths, Vector *variables, Vector *verbs, Vect
 	Compiler *comp = calloc(1, sizeof(Compiler));
 	comp->src_paths = src_paths;
 	comp->variables = variables ? variables : new_vec();
-	comp->symbols = new_string_hash();
+	comp->symbols = new_atom_hash();
 	comp->scos = calloc(src_paths->len, sizeof(Sco));
+	comp->arena = new_arena();
+	comp->atoms = new_interner(NULL);
 
-	for (int i = 0; i < comp->variables->len; i++)
-		hash_put(comp->symbols, comp->variables->data[i], new_symbol(VARIABLE, i));
+	for (int i = 0; i < comp->variables->len; i++) {
+		const char *name = comp->variables->data[i];
+		hash_put(comp->symbols, intern(comp->atoms, name, strlen(name)), new_symbol(comp, VARIABLE, i));
+	}
 	comp->verb_list = verbs ? verbs : new_vec();
-	comp->verb_map = init_verbobj_hash(verbs);
+	comp->verb_map = init_verbobj_hash(comp->atoms, verbs);
 	comp->obj_list = objs ? objs : new_vec();
-	comp->obj_map = init_verbobj_hash(objs);
+	comp->obj_map = init_verbobj_hash(comp->atoms, objs);
 
 	return comp;
 }
@@ -617,22 +824,60 @@ static void prepare(Compiler *comp, const char *source, int pageno) {
 }
 
 static void check_undefined_labels(void) {
-	for (int i = 0; i < labels->vals->len; i++) {
-		Label *l = labels->vals->data[i];
+	for (int i = 0; i < label_list->len; i++) {
+		Label *l = label_list->data[i];
 		if (l->hole_addr)
-			error_at(l->source_loc, "undefined label '%s'", labels->keys->data[i]);
+			error_at(l->source_loc, "undefined label '%s'", l->name);
 	}
 }
 
+// Frees the state that is used only while a page is being compiled.
+static void free_page_state(void) {
+	if (labels)
+		free_hash(labels);
+	labels = NULL;
+	if (label_list)
+		free_vec(label_list);
+	label_list = NULL;
+	if (accessed_symbols)
+		free_hash(accessed_symbols);
+	accessed_symbols = NULL;
+	if (code_map) {
+		free_vec(code_map->commands);
+		free_vec(code_map->slots);
+	}
+	code_map = NULL;
+	if (page_arena)
+		free_arena(page_arena);
+	page_arena = NULL;
+	if (page_atoms)
+		free_interner(page_atoms);
+	page_atoms = NULL;
+}
+
 Sco *compile(Compiler *comp, const char *source, int pageno) {
 	prepare(comp, source, pageno);
-	labels = new_map();
+	page_arena = new_arena();
+	page_atoms = new_interner(comp->atoms);
+	labels = new_atom_hash();
+	label_list = new_vec();
 
 	comp->scos[pageno].volume_bits = 1 << 1;
-	out = new_buf();
+	// The object code is usually smaller than its source.
+	out = new_buf_sized(strlen(source));
+	code_map = NULL;
+	if (config.optimize) {
+		code_map = arena_alloc(page_arena, sizeof(CodeMap));
+		code_map->commands = new_vec();
+		code_map->slots = new_vec();
+		record_slot(0);
+	}
 	emit_word(out, 0);  // Default address (to be filled later)
-	if (comp->dbg_info)
-		debug_init_page(comp->dbg_info, pageno);
+	linemap = comp->dbg_info ? new_linemap(64) : NULL;
+	symbol_accesses = comp->record_symbols ? new_vec() : NULL;
+	accessed_symbols = comp->record_symbols ? new_atom_hash() : NULL;
+	references = comp->record_references ? new_vec() : NULL;
+	sco_arena = comp->record_symbols || comp->record_references ? new_arena() : NULL;
 
 	toplevel();
 
@@ -640,14 +885,141 @@ Sco *compile(Compiler *comp, const char *source, int pageno) {
 		error_at(menu_item_start, "unfinished menu item");
 	check_undefined_labels();
 
-	Label *default_label = map_get(labels, "default");
-	if (!default_label)
-		fprintf(stderr, "%s: no default label\n", (char*)comp->src_paths->data[pageno]);
+	const char *default_atom = intern_lookup(page_atoms, "default", 7);
+	Label *default_label = default_atom ? hash_get(labels, default_atom) : NULL;
+	comp->scos[pageno].no_default_label = !default_label;
+	if (!default_label) {
+		leave_speculation();
+		if (diagnostics)
+			warn_at(input_buf, "no default label");
+		else
+			fprintf(stderr, "%s: no default label\n", (char*)comp->src_paths->data[pageno]);
+	}
 	swap_word(out, 0, default_label ? default_label->addr : out->len - 2);
+	if (code_map)
+		optimize_page(out, code_map, linemap);
 
-	if (comp->dbg_info)
-		debug_finish_page(comp->dbg_info);
 	comp->scos[pageno].buf = out;
+	comp->scos[pageno].linemap = linemap;
+	comp->scos[pageno].symbol_accesses = symbol_accesses;
+	comp->scos[pageno].references = references;
+	comp->scos[pageno].arena = sco_arena;
 	out = NULL;
+	linemap = NULL;
+	symbol_accesses = NULL;
+	references = NULL;
+	sco_arena = NULL;
+	free_page_state();
 	return &comp->scos[pageno];
 }
+
+Sco *try_compile(Compiler *comp, const char *source, int pageno) {
+	jmp_buf env;
+	if (setjmp(env)) {
+		speculation = NULL;
+		if (sco_arena)
+			free_arena(sco_arena);
+		sco_arena = NULL;
+		if (symbol_accesses)
+			free_vec(symbol_accesses);
+		symbol_accesses = NULL;
+		if (references)
+			free_vec(references);
+		references = NULL;
+		if (linemap)
+			free_linemap(linemap);
+		linemap = NULL;
+		if (out) {
+			free(out->buf);
+			free(out);
+		}
+		out = NULL;
+		free_page_state();
+		return NULL;
+	}
+	speculation = &env;
+	Sco *sco = compile(comp, source, pageno);
+	speculation = NULL;
+	return sco;
+}
+
+Sco *compile_with_diagnostics(Compiler *comp, const char *source, int pageno, Vector *diags) {
+	jmp_buf env;
+	diagnostics = diags;
+	if (setjmp(env)) {
+		error_recovery = NULL;
+		diagnostics = NULL;
+		Sco *sco = &comp->scos[pageno];
+		sco->symbol_accesses = symbol_accesses;
+		sco->references = references;
+		sco->arena = sco_arena;
+		symbol_accesses = NULL;
+		references = NULL;
+		sco_arena = NULL;
+		if (linemap)
+			free_linemap(linemap);
+		linemap = NULL;
+		if (out) {
+			free(out->buf);
+			free(out);
+		}
+		out = NULL;
+		free_page_state();
+		return NULL;
+	}
+	error_recovery = &env;
+	Sco *sco = compile(comp, source, pageno);
+	error_recovery = NULL;
+	diagnostics = NULL;
+	return sco;
+}
+
+void free_compiler(Compiler *comp) {
+	free_hash(comp->symbols);
+	free_hash(comp->verb_map);
+	free_hash(comp->obj_map);
+	free(comp->scos);
+	free_arena(comp->arena);
+	free_interner(comp->atoms);
+	free(comp);
+}
+
+// Looks up the symbol table by a string that may not be an atom.
+static Symbol *find_symbol(Compiler *comp, const char *name) {
+	const char *key = intern_lookup(comp->atoms, name, strlen(name));
+	return key ? hash_get(comp->symbols, key) : NULL;
+}
+
+bool replay_symbols(Compiler *comp, Vector *accesses) {
+	// Check everything before modifying the symbol table.
+	HashMap *defined = new_string_hash();
+	int nr_variables = comp->variables->len;
+	for (int i = 0; i < accesses->len; i++) {
+		SymbolAccess *a = accesses->data[i];
+		Symbol *sym = hash_get(defined, a->name);
+		if (!sym)
+			sym = find_symbol(comp, a->name);
+		if (a->define) {
+			if (sym || (a->type == VARIABLE && a->value != nr_variables++)) {
+				free_hash(defined);
+				return false;
+			}
+			hash_put(defined, a->name, new_symbol(comp, a->type, a->value));
+		} else if (sym ? (int)sym->type != a->type || sym->value != a->value : a->type != -1) {
+			free_hash(defined);
+			return false;
+		}
+	}
+
+	for (int i = 0; i < accesses->len; i++) {
+		SymbolAccess *a = accesses->data[i];
+		if (!a->define)
+			continue;
+		const char *key = intern(comp->atoms, a->name, strlen(a->name));
+		if (a->type == VARIABLE)
+			vec_push(comp->variables, (char *)key);
+		hash_put(comp->symbols, key, hash_get(defined, a->name));
+	}
+	free_hash(defined);
+	return true;
+}
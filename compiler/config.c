@@ -26,9 +26,9 @@ Config config = {
 };
 
 static bool to_bool(const char *s) {
-	if (strcasecmp(s, "yes") || strcasecmp(s, "true") || strcasecmp(s, "on") || strcmp(s, "1"))
+	if (!strcasecmp(s, "yes") || !strcasecmp(s, "true") || !strcasecmp(s, "on") || !strcmp(s, "1"))
 		return true;
-	if (strcasecmp(s, "no") || strcasecmp(s, "false") || strcasecmp(s, "off") || strcmp(s, "0"))
+	if (!strcasecmp(s, "no") || !strcasecmp(s, "false") || !strcasecmp(s, "off") || !strcmp(s, "0"))
 		return false;
 	error("Invalid boolean value '%s'", s);
 }
@@ -76,6 +76,10 @@ void load_config(FILE *fp, const char *cfg_dir) {
 				config.output_encoding = UTF8;
 		} else if (sscanf(line, "debug = %s", val)) {
 			config.debug = to_bool(val);
+		} else if (sscanf(line, "compress_symbols = %s", val)) {
+			config.compress_symbols = to_bool(val);
+		} else if (sscanf(line, "optimize = %s", val)) {
+			config.optimize = to_bool(val);
 		}
 	}
 }
@@ -21,12 +21,32 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define DSYM_VERSION 0
-
-typedef struct {
-	int line;
-	int addr;
-} LineInfo;
+// The .symbols file consists of a header ("DSYM", version, number of
+// sections) followed by sections, each starting with a four-character tag and
+// the section length. Since version 1, every section is padded to a multiple
+// of 4 bytes, and the LINE section is indexed by page:
+//
+//   "LINE" section_len nr_pages
+//   uint32 first[nr_pages + 1]  // index of the first entry of each page
+//   { uint32 line; uint32 addr; } entries[first[nr_pages]]
+//
+// The entries of page N are entries[first[N]] .. entries[first[N + 1] - 1],
+// sorted by address, so the file can be mapped into memory and searched
+// directly.
+//
+// With --compress-symbols, the SCNT section (source texts) is replaced with a
+// SCNZ section that stores each distinct source once, compressed with
+// lz_compress():
+//
+//   "SCNZ" section_len nr_pages
+//   uint32 content[nr_pages]  // index of the page's source in blobs
+//   uint32 nr_blobs
+//   { uint32 offset; uint32 size; uint32 packed_size; } blobs[nr_blobs]
+//   compressed data
+//
+// offset is relative to the start of the section, and size does not include
+// a terminating NUL.
+#define DSYM_VERSION 1
 
 typedef struct {
 	const char *name;
@@ -37,45 +57,36 @@ typedef struct {
 
 typedef struct DebugInfo {
 	Map *srcs;
-	Buffer *line_section;
-	Vector *linemap;
-	int nr_files;
+	Buffer *line_entries;
+	Vector *line_index;  // index of the first line entry of each page
+	int nr_lines;
 	Vector *functions;
 } DebugInfo;
 
-struct DebugInfo *new_debug_info(Map *srcs) {
+struct DebugInfo *new_debug_info(void) {
 	DebugInfo *di = calloc(1, sizeof(DebugInfo));
 	di->srcs = new_map();
-	for (int i = 0; i < srcs->keys->len; i++) {
-		char *key = srcs->keys->data[i] ? basename_utf8(srcs->keys->data[i]) : "";
-		char *val = srcs->vals->data[i] ? srcs->vals->data[i] : "";
-		map_put(di->srcs, key, val);
-	}
+	di->line_entries = new_buf();
+	di->line_index = new_vec();
 	di->functions = new_vec();
 	return di;
 }
 
-void debug_init_page(DebugInfo *di, int page) {
-	if (!di->line_section) {
-		di->line_section = new_buf();
-		emit(di->line_section, 'L');
-		emit(di->line_section, 'I');
-		emit(di->line_section, 'N');
-		emit(di->line_section, 'E');
-		emit_dword(di->line_section, 0);  // section length (to be filled later)
-		emit_dword(di->line_section, 0);  // nr_files (to be filled later)
-	}
-
-	assert(page == di->nr_files);
-	assert(!di->linemap);
-	di->linemap = new_vec();
+LineMap *new_linemap(int cap) {
+	LineMap *lm = calloc(1, sizeof(LineMap));
+	lm->cap = cap > 0 ? cap : 1;
+	lm->entries = malloc(sizeof(LineInfo) * lm->cap);
+	return lm;
 }
 
-void debug_line_add(DebugInfo *di, int line, int addr) {
-	Vector *linemap = di->linemap;
+void free_linemap(LineMap *lm) {
+	free(lm->entries);
+	free(lm);
+}
 
+void debug_line_add(LineMap *linemap, int line, int addr) {
 	if (linemap->len > 0) {
-		LineInfo *last = linemap->data[linemap->len - 1];
+		LineInfo *last = &linemap->entries[linemap->len - 1];
 		assert(addr >= last->addr);
 		assert(line >= last->line);
 		if (addr == last->addr) {
@@ -85,46 +96,123 @@ void debug_line_add(DebugInfo *di, int line, int addr) {
 		if (line == last->line)
 			return;
 	}
-	LineInfo *li = calloc(1, sizeof(LineInfo));
-	li->line = line;
-	li->addr = addr;
-	vec_push(linemap, li);
-	return;
+	if (linemap->len == linemap->cap) {
+		linemap->cap *= 2;
+		linemap->entries = realloc(linemap->entries, sizeof(LineInfo) * linemap->cap);
+	}
+	linemap->entries[linemap->len++] = (LineInfo){ line, addr };
 }
 
-void debug_finish_page(DebugInfo *di) {
-	Vector *linemap = di->linemap;
-	assert(linemap);
+void debug_add_page(DebugInfo *di, const char *path, const char *source, LineMap *linemap) {
+	map_put(di->srcs, path ? basename_utf8(path) : "", source ? (char *)source : "");
+
+	int len = linemap ? linemap->len : 0;
 
 	// Drop the last entry because it points to the end address of the SCO.
-	if (linemap->len > 0)
-		linemap->len--;
-
-	emit_dword(di->line_section, linemap->len);
-	for (int i = 0; i < linemap->len; i++) {
-		LineInfo *li = linemap->data[i];
-		emit_dword(di->line_section, li->line);
-		emit_dword(di->line_section, li->addr);
+	if (len > 0)
+		len--;
+
+	stack_push(di->line_index, di->nr_lines);
+	for (int i = 0; i < len; i++) {
+		LineInfo *li = &linemap->entries[i];
+		emit_dword(di->line_entries, li->line);
+		emit_dword(di->line_entries, li->addr);
 	}
-	di->linemap = NULL;
-	di->nr_files++;
+	di->nr_lines += len;
+}
 
-	swap_dword(di->line_section, 4, di->line_section->len);
-	swap_dword(di->line_section, 8, di->nr_files);
+static void pad_section(Buffer *out) {
+	while (out->len % 4)
+		emit(out, 0);
 }
 
-static void write_string_array_section(const char *tag, Vector *vec, FILE *fp) {
+static void write_string_array_section(const char *tag, Vector *vec, Buffer *out) {
 	int section_len = 12;
 	for (int i = 0; i < vec->len; i++)
 		section_len += strlen(vec->data[i]) + 1;
+	section_len = (section_len + 3) & ~3;
 
-	fputs(tag, fp);
-	fputdw(section_len, fp);
-	fputdw(vec->len, fp);
+	emit_string(out, tag);
+	emit_dword(out, section_len);
+	emit_dword(out, vec->len);
 	for (int i = 0; i < vec->len; i++) {
-		fputs(vec->data[i], fp);
-		fputc('\0', fp);
+		emit_string(out, vec->data[i]);
+		emit(out, '\0');
 	}
+	pad_section(out);
+}
+
+typedef struct {
+	const char *text;
+	size_t size;
+	uint8_t *packed;
+	size_t packed_size;
+} Blob;
+
+static void compress_blob(void *ctx, int i) {
+	Blob *b = ((Vector *)ctx)->data[i];
+	b->packed = lz_compress((const uint8_t *)b->text, b->size, &b->packed_size);
+}
+
+static void write_compressed_string_array_section(const char *tag, Vector *vec, Buffer *out) {
+	HashMap *blob_index = new_string_hash();
+	Vector *blobs = new_vec();
+	Vector *content = new_vec();
+	for (int i = 0; i < vec->len; i++) {
+		uintptr_t n = (uintptr_t)hash_get(blob_index, vec->data[i]);
+		if (!n) {
+			Blob *b = calloc(1, sizeof(Blob));
+			b->text = vec->data[i];
+			b->size = strlen(b->text);
+			vec_push(blobs, b);
+			n = blobs->len;
+			hash_put(blob_index, b->text, (void *)n);
+		}
+		stack_push(content, n - 1);
+	}
+	parallel_for(blobs->len, config.jobs, compress_blob, blobs);
+
+	uint32_t offset = 12 + vec->len * 4 + 4 + blobs->len * 12;
+	uint32_t section_len = offset;
+	for (int i = 0; i < blobs->len; i++)
+		section_len += ((Blob *)blobs->data[i])->packed_size;
+	section_len = (section_len + 3) & ~3;
+
+	emit_string(out, tag);
+	emit_dword(out, section_len);
+	emit_dword(out, vec->len);
+	for (int i = 0; i < vec->len; i++)
+		emit_dword(out, (uintptr_t)content->data[i]);
+	emit_dword(out, blobs->len);
+	for (int i = 0; i < blobs->len; i++) {
+		Blob *b = blobs->data[i];
+		emit_dword(out, offset);
+		emit_dword(out, b->size);
+		emit_dword(out, b->packed_size);
+		offset += b->packed_size;
+	}
+	for (int i = 0; i < blobs->len; i++) {
+		Blob *b = blobs->data[i];
+		emit_bytes(out, b->packed, b->packed_size);
+		free(b->packed);
+		free(b);
+	}
+	pad_section(out);
+
+	free_vec(content);
+	free_vec(blobs);
+	free_hash(blob_index);
+}
+
+static void write_line_section(DebugInfo *di, Buffer *out) {
+	int nr_pages = di->line_index->len;
+	emit_string(out, "LINE");
+	emit_dword(out, 12 + (nr_pages + 1) * 4 + di->line_entries->len);
+	emit_dword(out, nr_pages);
+	for (int i = 0; i < nr_pages; i++)
+		emit_dword(out, (uintptr_t)di->line_index->data[i]);
+	emit_dword(out, di->nr_lines);
+	emit_bytes(out, di->line_entries->buf, di->line_entries->len);
 }
 
 int funcinfo_compare(const void *a, const void *b) {
@@ -136,13 +224,16 @@ int funcinfo_compare(const void *a, const void *b) {
 		return fa->addr - fb->addr;
 }
 
-void debug_info_write(struct DebugInfo *di, Compiler *compiler, FILE *fp) {
-	fputs("DSYM", fp);
-	fputdw(DSYM_VERSION, fp);
-	fputdw(4, fp);  // nr_sections
+void debug_info_write(struct DebugInfo *di, Compiler *compiler, Buffer *out) {
+	emit_string(out, "DSYM");
+	emit_dword(out, DSYM_VERSION);
+	emit_dword(out, 4);  // nr_sections
 
-	write_string_array_section("SRCS", di->srcs->keys, fp);
-	write_string_array_section("SCNT", di->srcs->vals, fp);
-	fwrite(di->line_section->buf, di->line_section->len, 1, fp);
-	write_string_array_section("VARI", compiler->variables, fp);
+	write_string_array_section("SRCS", di->srcs->keys, out);
+	if (config.compress_symbols)
+		write_compressed_string_array_section("SCNZ", di->srcs->vals, out);
+	else
+		write_string_array_section("SCNT", di->srcs->vals, out);
+	write_line_section(di, out);
+	write_string_array_section("VARI", compiler->variables, out);
 }
@@ -21,35 +21,98 @@
 #include <stdlib.h>
 #include <string.h>
 
-const char *input_name;
-int input_page;
-const char *input_buf;
-const char *input;
-int input_line;
+_Thread_local const char *input_name;
+_Thread_local int input_page;
+_Thread_local const char *input_buf;
+_Thread_local const char *input;
+_Thread_local int input_line;
+_Thread_local jmp_buf *speculation;
+_Thread_local Vector *diagnostics;
+_Thread_local jmp_buf *error_recovery;
+_Thread_local Arena *page_arena;
+_Thread_local Interner *page_atoms;
 
-void warn_at(const char *pos, char *fmt, ...) {
-	int line = 1;
-	for (const char *begin = input_buf;; line++) {
-		const char *end = strchr(begin, '\n');
-		if (!end)  // last line
-			end = strchr(begin, '\0');
-		if (pos <= end) {
-			int col = pos - begin;
-			fprintf(stderr, "%s line %d column %d: ", input_name, line, col + 1);
-			va_list args;
-			va_start(args, fmt);
-			vfprintf(stderr, fmt, args);
-			fputc('\n', stderr);
-			fprintf(stderr, "%.*s\n", (int)(end - begin), begin);
-			for (const char *p = begin; p < pos; p++)
-				fputc(*p == '\t' ? '\t' : ' ', stderr);
-			fprintf(stderr, "^\n");
-			break;
-		}
-		if (!*end)
-			error("BUG: cannot find error location");
-		begin = end + 1;
+// Start positions of the lines of input_buf, built on the first diagnostic.
+static _Thread_local Vector *line_starts;
+static _Thread_local const char *line_starts_buf;
+
+static void build_line_starts(void) {
+	if (!line_starts)
+		line_starts = new_vec();
+	line_starts->len = 0;
+	vec_push(line_starts, (void *)input_buf);
+	for (const char *p = input_buf; (p = strchr(p, '\n')); p++)
+		vec_push(line_starts, (void *)(p + 1));
+	line_starts_buf = input_buf;
+}
+
+// Returns the 0-based line number of pos.
+static int find_line(const char *pos) {
+	if (line_starts_buf != input_buf)
+		build_line_starts();
+	int lo = 0, hi = line_starts->len;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if ((const char *)line_starts->data[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void report(const char *pos, bool is_error, char *fmt, va_list args) {
+	// Diagnostics are reported by the non-speculative compilation.
+	if (speculation)
+		longjmp(*speculation, 1);
+
+	int line = find_line(pos);
+	const char *begin = line_starts->data[line];
+	const char *end = strchr(begin, '\n');
+	if (!end)  // last line
+		end = strchr(begin, '\0');
+	if (pos < begin || pos > end)
+		error("BUG: cannot find error location");
+
+	if (diagnostics) {
+		va_list args2;
+		va_copy(args2, args);
+		int len = vsnprintf(NULL, 0, fmt, args2);
+		va_end(args2);
+		Diagnostic *d = calloc(1, sizeof(Diagnostic));
+		d->offset = pos - input_buf;
+		d->error = is_error;
+		d->message = malloc(len + 1);
+		vsnprintf(d->message, len + 1, fmt, args);
+		vec_push(diagnostics, d);
+		return;
 	}
+
+	int col = pos - begin;
+	fprintf(stderr, "%s line %d column %d: ", input_name, line + 1, col + 1);
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+	fprintf(stderr, "%.*s\n", (int)(end - begin), begin);
+	for (const char *p = begin; p < pos; p++)
+		fputc(*p == '\t' ? '\t' : ' ', stderr);
+	fprintf(stderr, "^\n");
+}
+
+void warn_at(const char *pos, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	report(pos, false, fmt, args);
+	va_end(args);
+}
+
+noreturn void error_at(const char *pos, char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	report(pos, true, fmt, args);
+	va_end(args);
+	if (error_recovery)
+		longjmp(*error_recovery, 1);
+	exit(1);
 }
 
 void lexer_init(const char *source, const char *name, int pageno) {
@@ -57,6 +120,7 @@ void lexer_init(const char *source, const char *name, int pageno) {
 	input_name = name;
 	input_page = pageno;
 	input_line = 1;
+	line_starts_buf = NULL;
 }
 
 void skip_whitespaces(void) {
@@ -135,36 +199,36 @@ static void advance_to_next_char(void) {
 		;
 }
 
-char *get_identifier(void) {
+const char *get_identifier(void) {
 	skip_whitespaces();
 	const char *top = input;
 	if (!is_identifier(*top) || isdigit(*top))
 		error_at(top, "identifier expected");
 	while (is_identifier(*input))
 		advance_to_next_char();
-	return strndup_(top, input - top);
+	return intern(page_atoms, top, input - top);
 }
 
-char *get_label(void) {
+const char *get_label(void) {
 	skip_whitespaces();
 	const char *top = input;
 	while (is_label(*input))
 		advance_to_next_char();
 	if (input == top)
 		error_at(top, "label expected");
-	return strndup_(top, input - top);
+	return intern(page_atoms, top, input - top);
 }
 
-char *get_filename(void) {
+const char *get_filename(void) {
 	const char *top = input;
 	while (is_identifier(*input))
 		advance_to_next_char();
 	if (input == top)
 		error_at(top, "file name expected");
-	return strndup_(top, input - top);
+	return intern(page_atoms, top, input - top);
 }
 
-char *get_string(void) {
+const char *get_string(void) {
 	skip_whitespaces();
 	expect('"');
 	const char *top = input;
@@ -173,7 +237,7 @@ char *get_string(void) {
 			error_at(top, "unfinished string");
 		advance_to_next_char();
 	}
-	char *key = strndup_(top, input - top);
+	const char *key = intern(page_atoms, top, input - top);
 	expect('"');
 	return key;
 }
@@ -196,10 +260,34 @@ int get_number(void) {
 	return n;
 }
 
+// Returns the length of the run of printable ASCII characters at s that are
+// copied to the output as-is, i.e. other than the terminator, `quote`, '<'
+// and '\\'.
+static int plain_ascii_run(const char *s, char terminator, char quote) {
+	int n = 0;
+	for (uint8_t c; (c = s[n]) >= ' ' && c < 0x80; n++) {
+		if (c == terminator || c == quote || c == '<' || c == '\\')
+			break;
+	}
+	return n;
+}
+
+static noreturn void unconvertible_char(const char *p) {
+	const uint8_t *s = (const uint8_t *)p;
+	if (*s >= 0xf0)
+		error_at(p, "Unsupported UTF-8 sequence");
+	int u = *s <= 0xdf ? (s[0] & 0x1f) << 6 | (s[1] & 0x3f)
+		: (s[0] & 0xf) << 12 | (s[1] & 0x3f) << 6 | (s[2] & 0x3f);
+	error_at(p, "Codepoint U+%04X cannot be converted to %s", u,
+			 config.output_encoding == MSX ? "MSX" : "Shift_JIS");
+}
+
 static void compile_multibyte_string(Buffer *b, bool compact) {
 	if (config.output_encoding == UTF8) {
+		const char *top = input;
 		while (!isascii(*input))
-			echo(b);
+			input++;
+		emit_bytes(b, top, input - top);
 		return;
 	}
 
@@ -208,37 +296,16 @@ static void compile_multibyte_string(Buffer *b, bool compact) {
 		input++;
 	if (!b)
 		return;
-	char *buf = alloca(input - top + 1);
-	strncpy(buf, top, input - top);
-	buf[input - top] = '\0';
-	if (config.output_encoding == MSX) {
-		int len;
-		char *msx = utf2msx_msg(buf, &len);
-		for (int i = 0; i < len; i++)
-			emit(b, (uint8_t)msx[i]);
-		return;
-	}
-
-	char *sjis = utf2sjis(buf);
-	if (!compact) {
-		emit_string(b, sjis);
-		return;
-	}
-	while (*sjis) {
-		uint8_t c1 = *sjis++;
-		if (!is_sjis_byte1(c1)) {
-			emit(b, c1);
-			continue;
-		}
-		uint8_t c2 = *sjis++;
-		uint8_t hk = compact_sjis(c1, c2);
-		if (hk) {
-			emit(b, hk);
-		} else {
-			emit(b, c1);
-			emit(b, c2);
-		}
-	}
+	// The encoded text is never longer than its UTF-8 form.
+	int len = input - top;
+	uint8_t *dst = reserve_bytes(b, len);
+	const char *invalid;
+	int n = config.output_encoding == MSX
+		? utf2msx_msg_to(top, len, dst, &invalid)
+		: utf2sjis_to(top, len, dst, compact, &invalid);
+	if (n < 0)
+		unconvertible_char(invalid);
+	b->len += n;
 }
 
 void compile_sjis_codepoint(Buffer *b) {
@@ -254,7 +321,9 @@ void compile_sjis_codepoint(Buffer *b) {
 			char buf[3] = { code >> 8, code & 0xff, 0 };
 			if (!is_valid_sjis(buf[0], buf[1]))
 				error_at(top, "Invalid SJIS code 0x%x", code);
-			emit_string(b, sjis2utf(buf));
+			char *utf = sjis2utf(buf);
+			emit_string(b, utf);
+			free(utf);
 		}
 		break;
 	case MSX:
@@ -265,7 +334,15 @@ void compile_sjis_codepoint(Buffer *b) {
 
 void compile_string(Buffer *b, char terminator, unsigned flags) {
 	const char *top = input;
+	char quote = flags & STRING_ESCAPE_SQUOTE ? '\'' : 0;
 	while (*input != terminator) {
+		if (!(flags & STRING_FORBID_ASCII)) {
+			int n = plain_ascii_run(input, terminator, quote);
+			emit_bytes(b, input, n);
+			input += n;
+			if (*input == terminator)
+				break;
+		}
 		if (*input == '<') {
 			compile_sjis_codepoint(b);
 			continue;
@@ -301,6 +378,11 @@ void compile_string(Buffer *b, char terminator, unsigned flags) {
 void compile_message(Buffer *b) {
 	const char *top = input;
 	while (*input && *input != '\'') {
+		int n = plain_ascii_run(input, '\'', 0);
+		emit_bytes(b, input, n);
+		input += n;
+		if (*input == '\'')
+			break;
 		if (*input == '<') {
 			compile_sjis_codepoint(b);
 			continue;
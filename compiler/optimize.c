@@ -0,0 +1,205 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Post-emission optimizer (-O). It works on the compiled code of a page, using
+// the command boundaries and the locations of code addresses recorded by the
+// compiler, so it does not need to decode the commands.
+
+#include "sys3c.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Buffer *b;
+	CodeMap *map;
+	int nr_commands;
+	int *command_at;  // index of the first command starting at each address, or -1
+	bool *is_slot;
+} Page;
+
+static CodeCommand *command(Page *pg, int i) {
+	return pg->map->commands->data[i];
+}
+
+static int command_end(Page *pg, int i) {
+	return i + 1 < pg->nr_commands ? command(pg, i + 1)->addr : pg->b->len;
+}
+
+static int slot(Page *pg, int i) {
+	return (intptr_t)pg->map->slots->data[i];
+}
+
+static int read_slot(Page *pg, int addr) {
+	return le16(pg->b->buf + addr);
+}
+
+// Returns the final destination of a jump to addr, following unconditional
+// jumps. Returns addr itself if the jumps form a loop.
+static int thread_jump(Page *pg, int addr) {
+	int dest = addr;
+	for (int n = 0; n < pg->nr_commands; n++) {
+		int i = dest < pg->b->len ? pg->command_at[dest] : -1;
+		if (i < 0)
+			return dest;
+		// Skip labels and other commands that generate no code.
+		while (i + 1 < pg->nr_commands && command_end(pg, i) == dest)
+			i++;
+		if (command(pg, i)->kind != CODE_JUMP || !pg->is_slot[dest + 1])
+			return dest;
+		dest = read_slot(pg, dest + 1);
+	}
+	return addr;
+}
+
+static void thread_jumps(Page *pg) {
+	for (int i = 0; i < pg->map->slots->len; i++) {
+		int s = slot(pg, i);
+		int dest = thread_jump(pg, read_slot(pg, s));
+		swap_word(pg->b, s, dest);
+	}
+}
+
+// Marks the commands reachable from the entry point. Returns false if a code
+// address does not point to a command.
+static bool mark_reachable(Page *pg, bool *reachable) {
+	Vector *stack = new_vec();
+
+	// Markers are treated as reachable, since a '{' may skip to the command
+	// after the closing '}'.
+	stack_push(stack, read_slot(pg, 0));
+	for (int i = 0; i < pg->nr_commands; i++) {
+		if (command(pg, i)->kind == CODE_MARKER)
+			stack_push(stack, command(pg, i)->addr);
+	}
+
+	bool ok = true;
+	while (ok && stack->len) {
+		int addr = stack_top(stack);
+		stack_pop(stack);
+		if (addr == pg->b->len)
+			continue;
+		int i = addr < pg->b->len ? pg->command_at[addr] : -1;
+		if (i < 0) {
+			ok = false;
+			break;
+		}
+		// Follow the fallthrough path until an already visited command.
+		for (; i < pg->nr_commands && !reachable[i]; i++) {
+			reachable[i] = true;
+			CodeCommand *c = command(pg, i);
+			for (int a = c->addr; a < command_end(pg, i); a++) {
+				if (pg->is_slot[a])
+					stack_push(stack, read_slot(pg, a));
+			}
+			if (c->kind == CODE_JUMP || c->kind == CODE_PAGE_JUMP || c->kind == CODE_RETURN)
+				break;
+		}
+	}
+	free_vec(stack);
+	return ok;
+}
+
+static void remove_unreachable(Page *pg, LineMap *linemap) {
+	bool *keep = calloc(pg->nr_commands, sizeof(bool));
+	if (pg->map->fixed_entry || !mark_reachable(pg, keep)) {
+		free(keep);
+		return;
+	}
+	for (int i = 0; i < pg->nr_commands; i++) {
+		CodeKind kind = command(pg, i)->kind;
+		if (kind == CODE_BRANCH || kind == CODE_MARKER)
+			keep[i] = true;
+	}
+
+	// Compute the new addresses of the commands.
+	int *new_addr = malloc((pg->nr_commands + 1) * sizeof(int));
+	int len = pg->nr_commands ? command(pg, 0)->addr : pg->b->len;
+	for (int i = 0; i < pg->nr_commands; i++) {
+		new_addr[i] = len;
+		if (keep[i])
+			len += command_end(pg, i) - command(pg, i)->addr;
+	}
+	new_addr[pg->nr_commands] = len;
+	if (len == pg->b->len) {
+		free(new_addr);
+		free(keep);
+		return;
+	}
+
+	// Relocate the code addresses, then move the commands.
+	for (int i = 0; i < pg->map->slots->len; i++) {
+		int s = slot(pg, i);
+		int dest = read_slot(pg, s);
+		int j = dest < pg->b->len ? pg->command_at[dest] : pg->nr_commands;
+		swap_word(pg->b, s, new_addr[j]);
+	}
+	uint8_t *code = pg->b->buf;
+	for (int i = 0; i < pg->nr_commands; i++) {
+		int start = command(pg, i)->addr;
+		if (keep[i])
+			memmove(code + new_addr[i], code + start, command_end(pg, i) - start);
+	}
+
+	if (linemap) {
+		int n = 0;
+		for (int i = 0; i < linemap->len; i++) {
+			LineInfo li = linemap->entries[i];
+			int j = li.addr < pg->b->len ? pg->command_at[li.addr] : -1;
+			if (j < 0) {
+				linemap->entries[n++] = li;  // before the first command
+				continue;
+			}
+			// Skip the commands without code that start at the same address.
+			while (!keep[j] && j + 1 < pg->nr_commands && command(pg, j + 1)->addr == li.addr)
+				j++;
+			if (!keep[j])
+				continue;
+			li.addr = new_addr[j];
+			linemap->entries[n++] = li;
+		}
+		linemap->len = n;
+	}
+	pg->b->len = len;
+	free(new_addr);
+	free(keep);
+}
+
+void optimize_page(Buffer *b, CodeMap *map, LineMap *linemap) {
+	Page pg = {
+		.b = b,
+		.map = map,
+		.nr_commands = map->commands->len,
+		.command_at = malloc(b->len * sizeof(int)),
+		.is_slot = calloc(b->len, sizeof(bool)),
+	};
+	for (int i = 0; i < b->len; i++)
+		pg.command_at[i] = -1;
+	for (int i = pg.nr_commands - 1; i >= 0; i--) {
+		int addr = command(&pg, i)->addr;
+		if (addr < b->len)
+			pg.command_at[addr] = i;
+	}
+	for (int i = 0; i < map->slots->len; i++)
+		pg.is_slot[slot(&pg, i)] = true;
+
+	thread_jumps(&pg);
+	remove_unreachable(&pg, linemap);
+
+	free(pg.command_at);
+	free(pg.is_slot);
+}
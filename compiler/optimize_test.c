@@ -0,0 +1,92 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Runs `sys3c -O` (the path is given as the argument) on small scenarios, and
+// checks the jump addresses in the generated code.
+
+#undef NDEBUG
+#include "common.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char sys3c[PATH_MAX];
+
+static void write_file(const char *path, const char *content) {
+	FILE *fp = fopen(path, "w");
+	assert(fp);
+	fputs(content, fp);
+	fclose(fp);
+}
+
+// Compiles `source` with -O and returns the code of page 0.
+static const uint8_t *compile(const char *source, int *size) {
+	write_file("a.adv", source);
+	char cmd[PATH_MAX + 64];
+	snprintf(cmd, sizeof(cmd), "'%s' -O a.adv", sys3c);
+	assert(system(cmd) == 0);
+	Vector *dri = dri_read(NULL, "ADISK.DAT");
+	DriEntry *e = dri->data[0];
+	*size = e->size;
+	return e->data;
+}
+
+static int read_word(const uint8_t *code, int addr) {
+	return code[addr] | code[addr + 1] << 8;
+}
+
+// A jump to a label right after a '}' is threaded through the zero-length
+// end of the block.
+static void test_thread_after_block(void) {
+	int size;
+	const uint8_t *code = compile(
+		"*default:\n"
+		"\t!D01:1!\n"
+		"\t{D01 = 1: @L1:}\n"
+		"*L1:\n"
+		"\t@L2:\n"
+		"\tA\n"
+		"*L2:\n"
+		"\tR\n", &size);
+	// 02 00 | !D01:1! | { D01 = 1 : <end> | @<L1> | *L1: @<L2> | *L2: R
+	assert(code[0x06] == '{' && code[0x0d] == '@' && code[0x10] == '@');
+	int l2 = read_word(code, 0x11);
+	assert(code[l2] == 'R');
+	assert(read_word(code, 0x0b) == l2);
+	assert(read_word(code, 0x0e) == l2);
+}
+
+int main(int argc, char *argv[]) {
+	assert(argc == 2);
+	assert(realpath(argv[1], sys3c));
+	char dir[] = "/tmp/optimize_test.XXXXXX";
+	assert(mkdtemp(dir));
+	assert(chdir(dir) == 0);
+
+	test_thread_after_block();
+
+	remove("ADISK.DAT");
+	remove("AG00.DAT");
+	remove("a.adv");
+	assert(chdir("/") == 0);
+	rmdir(dir);
+	return 0;
+}
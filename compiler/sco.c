@@ -21,9 +21,13 @@
 #include <string.h>
 
 Buffer *new_buf(void) {
+	return new_buf_sized(4096);
+}
+
+Buffer *new_buf_sized(int size) {
 	Buffer *b = malloc(sizeof(Buffer));
-	b->buf = calloc(1, 4096);
-	b->cap = 4096;
+	b->cap = size > 16 ? size : 16;
+	b->buf = malloc(b->cap);
 	b->len = 0;
 	return b;
 }
@@ -36,6 +40,20 @@ void emit(Buffer *b, uint8_t c) {
 	b->buf[b->len++] = c;
 }
 
+uint8_t *reserve_bytes(Buffer *b, int len) {
+	if (b->len + len > b->cap) {
+		while (b->len + len > b->cap)
+			b->cap *= 2;
+		b->buf = realloc(b->buf, b->cap);
+	}
+	return b->buf + b->len;
+}
+
+void emit_bytes(Buffer *b, const void *data, int len) {
+	memcpy(reserve_bytes(b, len), data, len);
+	b->len += len;
+}
+
 void emit_word(Buffer *b, uint16_t v) {
 	emit(b, v & 0xff);
 	emit(b, v >> 8 & 0xff);
@@ -54,8 +72,7 @@ void emit_dword(Buffer *b, uint32_t v) {
 }
 
 void emit_string(Buffer *b, const char *s) {
-	while (*s)
-		emit(b, *s++);
+	emit_bytes(b, s, strlen(s));
 }
 
 int current_address(Buffer *b) {
@@ -0,0 +1,732 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Query server for editors (sys3c --server). It speaks JSON-RPC 2.0 over
+// stdin/stdout, using the framing and the methods of the Language Server
+// Protocol. The project is loaded once. Whenever a buffer changes, the pages
+// are analyzed again, reusing the results of the pages whose source and symbol
+// table accesses are unchanged, as in incremental builds.
+
+#include "sys3c.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// JSON-RPC error codes
+#define PARSE_ERROR -32700
+#define INVALID_REQUEST -32600
+#define METHOD_NOT_FOUND -32601
+
+typedef struct {
+	const char *path;  // NULL if the page has no source
+	char *abs_path;
+	char *uri;
+	char *text;        // UTF-8 source ending with "\n\0"
+	size_t text_len;
+	bool open;         // `text` is an editor buffer rather than the file
+	char *load_error;  // the file could not be read or decoded
+	int load_error_offset;
+	Vector *line_starts;  // line start offsets in `text`, built on demand
+
+	// Results of the last analysis.
+	bool ok;  // compiled without errors
+	uint64_t hash;
+	Vector *accesses;    // SymbolAccess*
+	Vector *references;  // Reference*
+	Arena *arena;        // owns accesses and references
+	Vector *diags;       // Diagnostic*
+	bool diags_changed;
+	bool diags_published;  // a non-empty list has been published
+} Page;
+
+typedef struct {
+	Vector *src_paths;
+	Vector *initial_vars;
+	Vector *vars;  // passed to new_compiler(), which adds to it
+	const char *var_list;
+	char *var_list_uri;
+	Vector *verbs;
+	Vector *objs;
+	Page *pages;
+	HashMap *uri_map;  // URI -> Page*
+	bool shutdown;
+} Server;
+
+static char *absolute_path(const char *path) {
+#ifdef _WIN32
+	return _fullpath(NULL, path, 0);
+#else
+	return realpath(path, NULL);
+#endif
+}
+
+static bool is_uri_safe(uint8_t c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("-._~/", c);
+}
+
+static char *path_to_uri(const char *abs_path) {
+	char *uri = malloc(strlen(abs_path) * 3 + 9);
+	char *d = uri + sprintf(uri, "file://");
+#ifdef _WIN32
+	*d++ = '/';
+#endif
+	for (const uint8_t *p = (const uint8_t *)abs_path; *p; p++) {
+		uint8_t c = *p == '\\' ? '/' : *p;
+		if (is_uri_safe(c) || (c == ':' && p == (const uint8_t *)abs_path + 1))
+			*d++ = c;
+		else
+			d += sprintf(d, "%%%02X", c);
+	}
+	*d = '\0';
+	return uri;
+}
+
+// Returns the file path for a "file:" URI, or NULL.
+static char *uri_to_path(const char *uri) {
+	if (strncmp(uri, "file://", 7))
+		return NULL;
+	const char *p = uri + 7;
+#ifdef _WIN32
+	if (*p == '/')
+		p++;
+#endif
+	char *path = malloc(strlen(p) + 1);
+	char *d = path;
+	for (; *p; p++) {
+		unsigned c;
+		if (*p == '%' && sscanf(p + 1, "%2x", &c) == 1) {
+			*d++ = c;
+			p += 2;
+		} else {
+			*d++ = *p;
+		}
+	}
+	*d = '\0';
+	return path;
+}
+
+static Page *find_page(Server *sv, const char *uri) {
+	Page *pg = hash_get(sv->uri_map, uri);
+	if (pg)
+		return pg;
+	// The client may spell the URI differently, e.g. with a symbolic link.
+	char *path = uri_to_path(uri);
+	char *abs_path = path ? absolute_path(path) : NULL;
+	for (int i = 0; abs_path && i < sv->src_paths->len; i++) {
+		if (sv->pages[i].abs_path && !strcmp(sv->pages[i].abs_path, abs_path)) {
+			pg = &sv->pages[i];
+			break;
+		}
+	}
+	free(abs_path);
+	free(path);
+	return pg;
+}
+
+static void set_text(Page *pg, char *text) {
+	free(pg->text);
+	free(pg->load_error);
+	pg->text = text;
+	pg->text_len = strlen(text);
+	pg->load_error = NULL;
+	if (pg->line_starts)
+		pg->line_starts->len = 0;
+}
+
+static void set_load_error(Page *pg, int offset, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	char buf[1024];
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	pg->load_error = strdup(buf);
+	pg->load_error_offset = offset;
+}
+
+static void load_page(Page *pg) {
+	char *raw = try_load_file(pg->path, NULL);
+	if (!raw) {
+		int err = errno;
+		set_text(pg, strdup("\n"));
+		set_load_error(pg, 0, "cannot open %s: %s", pg->path, strerror(err));
+		return;
+	}
+	const char *invalid;
+	char *text = convert_source(raw, &invalid);
+	if (text != raw)
+		free(raw);
+	set_text(pg, text);
+	if (invalid)
+		set_load_error(pg, invalid - text, config.utf8 ? "Invalid UTF-8 character" : "Invalid Shift_JIS character");
+}
+
+static void set_buffer(Page *pg, const char *buffer) {
+	size_t len = strlen(buffer);
+	char *text = malloc(len + 2);
+	memcpy(text, buffer, len);
+	text[len] = '\n';
+	text[len + 1] = '\0';
+	set_text(pg, text);
+	const char *invalid = validate_utf8(text);
+	if (invalid)
+		set_load_error(pg, invalid - text, "Invalid UTF-8 character");
+}
+
+static void free_diagnostics(Vector *diags) {
+	for (int i = 0; i < diags->len; i++) {
+		Diagnostic *d = diags->data[i];
+		free(d->message);
+		free(d);
+	}
+	diags->len = 0;
+}
+
+static void analyze_page(Server *sv, Compiler *comp, int i) {
+	Page *pg = &sv->pages[i];
+	if (pg->arena)
+		free_arena(pg->arena);
+	pg->arena = NULL;
+	if (pg->accesses)
+		free_vec(pg->accesses);
+	if (pg->references)
+		free_vec(pg->references);
+	pg->accesses = pg->references = NULL;
+	free_diagnostics(pg->diags);
+	pg->diags_changed = true;
+
+	if (pg->load_error) {
+		Diagnostic *d = calloc(1, sizeof(Diagnostic));
+		d->offset = pg->load_error_offset;
+		d->error = true;
+		d->message = strdup(pg->load_error);
+		vec_push(pg->diags, d);
+		pg->ok = false;
+		return;
+	}
+
+	Sco *sco = &comp->scos[i];
+	pg->ok = compile_with_diagnostics(comp, pg->text, i, pg->diags) != NULL;
+	pg->accesses = sco->symbol_accesses;
+	pg->references = sco->references;
+	pg->arena = sco->arena;
+	if (sco->buf) {
+		free(sco->buf->buf);
+		free(sco->buf);
+	}
+}
+
+static void publish_diagnostics(Server *sv);
+
+// Analyzes the pages in order, like a build.
+static void analyze(Server *sv) {
+	sv->vars->len = 0;
+	for (int i = 0; i < sv->initial_vars->len; i++)
+		vec_push(sv->vars, sv->initial_vars->data[i]);
+	Compiler *comp = new_compiler(sv->src_paths, sv->vars, sv->verbs, sv->objs);
+	comp->record_symbols = true;
+	comp->record_references = true;
+
+	for (int i = 0; i < sv->src_paths->len; i++) {
+		Page *pg = &sv->pages[i];
+		if (!pg->path)
+			continue;
+		uint64_t hash = hash_data(pg->text, pg->text_len);
+		if (pg->ok && pg->hash == hash && replay_symbols(comp, pg->accesses))
+			continue;
+		pg->hash = hash;
+		analyze_page(sv, comp, i);
+	}
+	free_compiler(comp);
+	publish_diagnostics(sv);
+}
+
+// Positions
+
+static void build_line_starts(Page *pg) {
+	if (!pg->line_starts)
+		pg->line_starts = new_vec();
+	vec_push(pg->line_starts, (void *)0);
+	for (const char *p = pg->text; (p = strchr(p, '\n')); p++)
+		vec_push(pg->line_starts, (void *)(intptr_t)(p + 1 - pg->text));
+}
+
+static int line_start(Page *pg, int line) {
+	return (intptr_t)pg->line_starts->data[line];
+}
+
+// LSP positions count characters in UTF-16 code units.
+static void offset_to_position(Page *pg, int offset, int *line, int *character) {
+	if (!pg->line_starts || !pg->line_starts->len)
+		build_line_starts(pg);
+	int lo = 0, hi = pg->line_starts->len;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (line_start(pg, mid) <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*line = lo;
+	*character = 0;
+	for (const char *p = pg->text + line_start(pg, lo); p < pg->text + offset; p++) {
+		if (!UTF8_TRAIL_BYTE(*p))
+			*character += (uint8_t)*p >= 0xf0 ? 2 : 1;
+	}
+}
+
+static int position_to_offset(Page *pg, int line, int character) {
+	if (!pg->line_starts || !pg->line_starts->len)
+		build_line_starts(pg);
+	if (line < 0 || line >= pg->line_starts->len)
+		return -1;
+	const char *p = pg->text + line_start(pg, line);
+	for (int units = 0; units < character && *p != '\n';) {
+		units += (uint8_t)*p >= 0xf0 ? 2 : 1;
+		do
+			p++;
+		while (UTF8_TRAIL_BYTE(*p));
+	}
+	return p - pg->text;
+}
+
+// Output
+
+static void emit_fmt(Buffer *b, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	char *p = (char *)reserve_bytes(b, len + 1);
+	va_start(args, fmt);
+	vsnprintf(p, len + 1, fmt, args);
+	va_end(args);
+	b->len += len;
+}
+
+static void emit_json_string(Buffer *b, const char *s) {
+	emit(b, '"');
+	for (; *s; s++) {
+		uint8_t c = *s;
+		if (c == '"' || c == '\\') {
+			emit(b, '\\');
+			emit(b, c);
+		} else if (c < 0x20) {
+			emit_fmt(b, "\\u%04x", c);
+		} else {
+			emit(b, c);
+		}
+	}
+	emit(b, '"');
+}
+
+static void emit_id(Buffer *b, const Json *id) {
+	if (id && id->type == JSON_STRING)
+		emit_json_string(b, id->string);
+	else if (id && id->type == JSON_NUMBER)
+		emit_fmt(b, "%.17g", id->number);
+	else
+		emit_string(b, "null");
+}
+
+static void emit_range(Buffer *b, Page *pg, int offset, int length) {
+	int line, character, end_line, end_character;
+	offset_to_position(pg, offset, &line, &character);
+	offset_to_position(pg, offset + length, &end_line, &end_character);
+	emit_fmt(b, "{\"start\":{\"line\":%d,\"character\":%d},\"end\":{\"line\":%d,\"character\":%d}}",
+			 line, character, end_line, end_character);
+}
+
+static void emit_location(Buffer *b, Page *pg, int offset, int length) {
+	emit_string(b, "{\"uri\":");
+	emit_json_string(b, pg->uri);
+	emit_string(b, ",\"range\":");
+	emit_range(b, pg, offset, length);
+	emit(b, '}');
+}
+
+// Locations in the variable list.
+static void emit_variable_location(Buffer *b, Server *sv, int index) {
+	emit_string(b, "{\"uri\":");
+	emit_json_string(b, sv->var_list_uri);
+	emit_fmt(b, ",\"range\":{\"start\":{\"line\":%d,\"character\":0},\"end\":{\"line\":%d,\"character\":0}}}",
+			 index, index + 1);
+}
+
+static void send_message(Buffer *b) {
+	printf("Content-Length: %d\r\n\r\n", b->len);
+	fwrite(b->buf, b->len, 1, stdout);
+	fflush(stdout);
+	free(b->buf);
+	free(b);
+}
+
+// Returns a buffer that contains the beginning of a response. The caller
+// appends the result and passes it to send_result().
+static Buffer *begin_result(const Json *id) {
+	Buffer *b = new_buf();
+	emit_string(b, "{\"jsonrpc\":\"2.0\",\"id\":");
+	emit_id(b, id);
+	emit_string(b, ",\"result\":");
+	return b;
+}
+
+static void send_result(Buffer *b) {
+	emit(b, '}');
+	send_message(b);
+}
+
+static void send_error(const Json *id, int code, const char *message) {
+	Buffer *b = new_buf();
+	emit_string(b, "{\"jsonrpc\":\"2.0\",\"id\":");
+	emit_id(b, id);
+	emit_fmt(b, ",\"error\":{\"code\":%d,\"message\":", code);
+	emit_json_string(b, message);
+	emit_string(b, "}}");
+	send_message(b);
+}
+
+static void publish_diagnostics(Server *sv) {
+	for (int i = 0; i < sv->src_paths->len; i++) {
+		Page *pg = &sv->pages[i];
+		if (!pg->diags_changed || !pg->uri || (!pg->diags->len && !pg->diags_published))
+			continue;
+		pg->diags_changed = false;
+		pg->diags_published = pg->diags->len > 0;
+
+		Buffer *b = new_buf();
+		emit_string(b, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+		emit_json_string(b, pg->uri);
+		emit_string(b, ",\"diagnostics\":[");
+		for (int j = 0; j < pg->diags->len; j++) {
+			Diagnostic *d = pg->diags->data[j];
+			// Mark the character at the position.
+			int len = 0;
+			if (pg->text[d->offset] != '\n') {
+				do
+					len++;
+				while (UTF8_TRAIL_BYTE(pg->text[d->offset + len]));
+			}
+			if (j)
+				emit(b, ',');
+			emit_string(b, "{\"range\":");
+			emit_range(b, pg, d->offset, len);
+			emit_fmt(b, ",\"severity\":%d,\"source\":\"sys3c\",\"message\":", d->error ? 1 : 2);
+			emit_json_string(b, d->message);
+			emit(b, '}');
+		}
+		emit_string(b, "]}}");
+		send_message(b);
+	}
+}
+
+// Queries
+
+static Reference *reference_at(Page *pg, int offset) {
+	for (int i = 0; pg->references && i < pg->references->len; i++) {
+		Reference *r = pg->references->data[i];
+		if (r->offset <= offset && offset <= r->offset + r->length)
+			return r;
+	}
+	return NULL;
+}
+
+static bool same_target(Page *pg, Reference *r, Page *pg2, Reference *r2) {
+	if (r->kind != r2->kind)
+		return false;
+	switch (r->kind) {
+	case REF_LABEL:
+		return pg == pg2 && !strcmp(r->name, r2->name);
+	case REF_SYMBOL:
+		return !strcmp(r->name, r2->name);
+	case REF_PAGE:
+		return r->page == r2->page;
+	}
+	return false;
+}
+
+static int initial_variable_index(Server *sv, const char *name) {
+	for (int i = 0; i < sv->initial_vars->len; i++) {
+		if (!strcmp(sv->initial_vars->data[i], name))
+			return i;
+	}
+	return -1;
+}
+
+// Parses TextDocumentPositionParams. Returns the reference at the position.
+static Reference *reference_at_position(Server *sv, const Json *params, Page **ppg) {
+	Json *uri = json_get(json_get(params, "textDocument"), "uri");
+	Json *pos = json_get(params, "position");
+	Json *line = json_get(pos, "line");
+	Json *character = json_get(pos, "character");
+	if (!uri || uri->type != JSON_STRING || !line || !character)
+		return NULL;
+	Page *pg = find_page(sv, uri->string);
+	if (!pg || !pg->path)
+		return NULL;
+	int offset = position_to_offset(pg, line->number, character->number);
+	if (offset < 0)
+		return NULL;
+	*ppg = pg;
+	return reference_at(pg, offset);
+}
+
+static void definition(Server *sv, const Json *id, const Json *params) {
+	Page *pg;
+	Reference *r = reference_at_position(sv, params, &pg);
+	Buffer *b = begin_result(id);
+	if (r && r->kind == REF_PAGE) {
+		emit_location(b, &sv->pages[r->page], 0, 0);
+		send_result(b);
+		return;
+	}
+	// Labels are local to a page. Variables and constants are defined by the
+	// variable list or by the first page that uses or defines them.
+	for (int i = 0; r && i < sv->src_paths->len; i++) {
+		Page *pg2 = &sv->pages[i];
+		if (r->kind == REF_LABEL && pg2 != pg)
+			continue;
+		for (int j = 0; pg2->references && j < pg2->references->len; j++) {
+			Reference *r2 = pg2->references->data[j];
+			if (r2->define && same_target(pg, r, pg2, r2)) {
+				emit_location(b, pg2, r2->offset, r2->length);
+				send_result(b);
+				return;
+			}
+		}
+	}
+	int var = r && r->kind == REF_SYMBOL && sv->var_list_uri ? initial_variable_index(sv, r->name) : -1;
+	if (var >= 0)
+		emit_variable_location(b, sv, var);
+	else
+		emit_string(b, "null");
+	send_result(b);
+}
+
+static void references(Server *sv, const Json *id, const Json *params) {
+	Page *pg;
+	Reference *r = reference_at_position(sv, params, &pg);
+	Json *include_decl = json_get(json_get(params, "context"), "includeDeclaration");
+	bool with_decl = include_decl && include_decl->type == JSON_TRUE;
+
+	Buffer *b = begin_result(id);
+	emit(b, '[');
+	bool first = true;
+	if (r && r->kind == REF_SYMBOL && with_decl && sv->var_list_uri) {
+		int var = initial_variable_index(sv, r->name);
+		if (var >= 0) {
+			emit_variable_location(b, sv, var);
+			first = false;
+		}
+	}
+	for (int i = 0; r && i < sv->src_paths->len; i++) {
+		Page *pg2 = &sv->pages[i];
+		for (int j = 0; pg2->references && j < pg2->references->len; j++) {
+			Reference *r2 = pg2->references->data[j];
+			if ((r2->define && !with_decl) || !same_target(pg, r, pg2, r2))
+				continue;
+			if (!first)
+				emit(b, ',');
+			first = false;
+			emit_location(b, pg2, r2->offset, r2->length);
+		}
+	}
+	emit(b, ']');
+	send_result(b);
+}
+
+// Notifications
+
+static bool document_notification(Server *sv, const char *method, const Json *params) {
+	Json *doc = json_get(params, "textDocument");
+	Json *uri = json_get(doc, "uri");
+	Page *pg = uri && uri->type == JSON_STRING ? find_page(sv, uri->string) : NULL;
+	if (!pg || !pg->path)
+		return false;
+
+	if (!strcmp(method, "textDocument/didOpen")) {
+		Json *text = json_get(doc, "text");
+		if (!text || text->type != JSON_STRING)
+			return false;
+		set_buffer(pg, text->string);
+		pg->open = true;
+	} else if (!strcmp(method, "textDocument/didChange")) {
+		// Only full document sync is supported; the last change has the text.
+		Json *change = json_get(params, "contentChanges");
+		Json *text = NULL;
+		for (Json *c = change ? change->child : NULL; c; c = c->next)
+			text = json_get(c, "text");
+		if (!text || text->type != JSON_STRING)
+			return false;
+		set_buffer(pg, text->string);
+	} else if (!strcmp(method, "textDocument/didClose")) {
+		pg->open = false;
+		load_page(pg);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool files_changed(Server *sv, const Json *params) {
+	Json *changes = json_get(params, "changes");
+	bool changed = false;
+	for (Json *c = changes ? changes->child : NULL; c; c = c->next) {
+		Json *uri = json_get(c, "uri");
+		Page *pg = uri && uri->type == JSON_STRING ? find_page(sv, uri->string) : NULL;
+		if (pg && pg->path && !pg->open) {
+			load_page(pg);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+static void initialize(const Json *id) {
+	Buffer *b = begin_result(id);
+	emit_string(b, "{\"capabilities\":{"
+				"\"positionEncoding\":\"utf-16\","
+				"\"textDocumentSync\":{\"openClose\":true,\"change\":1},"
+				"\"definitionProvider\":true,"
+				"\"referencesProvider\":true},"
+				"\"serverInfo\":{\"name\":\"sys3c\",\"version\":\"" VERSION "\"}}");
+	send_result(b);
+}
+
+// Returns false when the server should exit.
+static bool handle_message(Server *sv, const Json *msg) {
+	Json *id = json_get(msg, "id");
+	Json *method = json_get(msg, "method");
+	Json *params = json_get(msg, "params");
+	if (!method || method->type != JSON_STRING) {
+		if (id)
+			send_error(id, INVALID_REQUEST, "method expected");
+		return true;
+	}
+	const char *m = method->string;
+
+	if (!id) {
+		if (!strcmp(m, "exit"))
+			return false;
+		if (!strcmp(m, "initialized"))
+			analyze(sv);
+		else if (!strncmp(m, "textDocument/", 13) && document_notification(sv, m, params))
+			analyze(sv);
+		else if (!strcmp(m, "workspace/didChangeWatchedFiles") && files_changed(sv, params))
+			analyze(sv);
+		// Other notifications are ignored.
+		return true;
+	}
+
+	if (!strcmp(m, "initialize")) {
+		initialize(id);
+	} else if (!strcmp(m, "shutdown")) {
+		sv->shutdown = true;
+		Buffer *b = begin_result(id);
+		emit_string(b, "null");
+		send_result(b);
+	} else if (!strcmp(m, "textDocument/definition")) {
+		definition(sv, id, params);
+	} else if (!strcmp(m, "textDocument/references")) {
+		references(sv, id, params);
+	} else {
+		send_error(id, METHOD_NOT_FOUND, "method not found");
+	}
+	return true;
+}
+
+// Reads a message body. Returns NULL at the end of input.
+static char *read_message(size_t *plen) {
+	long len = -1;
+	char line[256];
+	for (;;) {
+		if (!fgets(line, sizeof(line), stdin))
+			return NULL;
+		if (!strcmp(line, "\r\n") || !strcmp(line, "\n")) {
+			if (len >= 0)
+				break;
+		} else if (!strncasecmp(line, "Content-Length:", 15)) {
+			len = strtol(line + 15, NULL, 10);
+		}
+	}
+	char *buf = malloc(len + 1);
+	if (fread(buf, 1, len, stdin) != len) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+	*plen = len;
+	return buf;
+}
+
+int run_server(Vector *src_paths, Vector *variables, const char *var_list, Vector *verbs, Vector *objs) {
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	Server sv = {
+		.src_paths = src_paths,
+		.initial_vars = variables ? variables : new_vec(),
+		.vars = new_vec(),
+		.var_list = var_list,
+		// Given to every compiler, which would otherwise create empty lists.
+		.verbs = verbs ? verbs : new_vec(),
+		.objs = objs ? objs : new_vec(),
+		.pages = calloc(src_paths->len, sizeof(Page)),
+		.uri_map = new_string_hash(),
+	};
+	char *abs_var_list = var_list ? absolute_path(var_list) : NULL;
+	if (abs_var_list)
+		sv.var_list_uri = path_to_uri(abs_var_list);
+	free(abs_var_list);
+
+	for (int i = 0; i < src_paths->len; i++) {
+		Page *pg = &sv.pages[i];
+		pg->path = src_paths->data[i];
+		pg->diags = new_vec();
+		if (!pg->path)
+			continue;
+		load_page(pg);
+		pg->abs_path = absolute_path(pg->path);
+		if (pg->abs_path) {
+			pg->uri = path_to_uri(pg->abs_path);
+			hash_put(sv.uri_map, pg->uri, pg);
+		}
+	}
+
+	size_t len;
+	char *buf;
+	while ((buf = read_message(&len))) {
+		Arena *arena = new_arena();
+		Json *msg = json_parse(arena, buf, len);
+		bool running = true;
+		if (msg)
+			running = handle_message(&sv, msg);
+		else
+			send_error(NULL, PARSE_ERROR, "parse error");
+		free_arena(arena);
+		free(buf);
+		if (!running)
+			return sv.shutdown ? 0 : 1;
+	}
+	return 1;
+}
@@ -0,0 +1,99 @@
+/* Copyright (C) 2026 <KichikuouChrome@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+*/
+
+// Runs `sys3c --server` (the path is given as the argument) on a sequence of
+// editor messages, and checks the diagnostics it publishes.
+
+#undef NDEBUG
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void write_file(const char *path, const char *content) {
+	FILE *fp = fopen(path, "w");
+	assert(fp);
+	fputs(content, fp);
+	fclose(fp);
+}
+
+static void send(FILE *fp, const char *fmt, ...) {
+	char body[1024];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(body, sizeof(body), fmt, args);
+	va_end(args);
+	assert(len < (int)sizeof(body));
+	fprintf(fp, "Content-Length: %d\r\n\r\n%s", len, body);
+}
+
+static void change(FILE *fp, const char *uri, int version, const char *text) {
+	send(fp, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":"
+		 "{\"textDocument\":{\"uri\":\"%s\",\"version\":%d},\"contentChanges\":[{\"text\":\"%s\"}]}}",
+		 uri, version, text);
+}
+
+int main(int argc, char *argv[]) {
+	assert(argc == 2);
+	char sys3c[PATH_MAX];
+	assert(realpath(argv[1], sys3c));
+	char dir[] = "/tmp/server_test.XXXXXX";
+	assert(mkdtemp(dir));
+	assert(chdir(dir) == 0);
+	write_file("a.adv", "*default:\n\tR\n");
+	char uri[PATH_MAX + 16];
+	snprintf(uri, sizeof(uri), "file://%s/a.adv", dir);
+
+	char cmd[PATH_MAX + 64];
+	snprintf(cmd, sizeof(cmd), "'%s' --server a.adv > out.txt", sys3c);
+	FILE *fp = popen(cmd, "w");
+	assert(fp);
+	send(fp, "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",\"params\":{}}");
+	// Characters that cannot be converted to Shift_JIS are reported as
+	// diagnostics, and the server keeps running.
+	send(fp, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":"
+		 "{\"textDocument\":{\"uri\":\"%s\",\"languageId\":\"sys3\",\"version\":1,"
+		 "\"text\":\"*default:\\n\\t'\xf0\x9f\x98\x80' A\\n\\tR\\n\"}}}", uri);
+	change(fp, uri, 2, "*default:\\n\\t'\xe4\xb8\x82' A\\n\\tR\\n");
+	change(fp, uri, 3, "*default:\\n\\t'\xe3\x81\x82' A\\n\\tR\\n");
+	send(fp, "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"shutdown\"}");
+	send(fp, "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}");
+	assert(pclose(fp) == 0);
+
+	FILE *out = fopen("out.txt", "rb");
+	assert(out);
+	static char buf[65536];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, out);
+	fclose(out);
+	buf[len] = '\0';
+	const char *p = strstr(buf, "Unsupported UTF-8 sequence");
+	assert(p);
+	p = strstr(p, "Codepoint U+4E02 cannot be converted to Shift_JIS");
+	assert(p);
+	assert(strstr(p, "\"diagnostics\":[]"));
+	assert(strstr(p, "\"id\":2,\"result\":null"));
+
+	remove("out.txt");
+	remove("a.adv");
+	assert(chdir("/") == 0);
+	rmdir(dir);
+	return 0;
+}
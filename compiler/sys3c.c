@@ -23,22 +23,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #define DEFAULT_ADISK_NAME "ADISK.DAT"
 
-static const char short_options[] = "d:E:G:ghi:o:p:uV:v";
+// Options without a short form
+enum {
+	OPT_SERVER = 0x100,
+	OPT_COMPRESS_SYMBOLS,
+};
+
+static const char short_options[] = "d:E:G:ghIi:j:Oo:p:uV:vw";
 static const struct option long_options[] = {
 	{ "outdir",    required_argument, NULL, 'd' },
 	{ "encoding",  required_argument, NULL, 'E' },
 	{ "game",      required_argument, NULL, 'G' },
 	{ "debug",     no_argument,       NULL, 'g' },
+	{ "compress-symbols", no_argument, NULL, OPT_COMPRESS_SYMBOLS },
 	{ "help",      no_argument,       NULL, 'h' },
 	{ "hed",       required_argument, NULL, 'i' },
+	{ "incremental", no_argument,     NULL, 'I' },
+	{ "jobs",      required_argument, NULL, 'j' },
 	{ "dri",       required_argument, NULL, 'o' },
+	{ "optimize",  no_argument,       NULL, 'O' },
 	{ "project",   required_argument, NULL, 'p' },
+	{ "server",    no_argument,       NULL, OPT_SERVER },
 	{ "unicode",   no_argument,       NULL, 'u' },
 	{ "variables", required_argument, NULL, 'V' },
 	{ "version",   no_argument,       NULL, 'v' },
+	{ "watch",     no_argument,       NULL, 'w' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -48,21 +66,47 @@ static void usage(void) {
 	puts("    -d, --outdir <dir>        Specify output directory");
 	puts("    -o, --dri <name>          Write output to <name> (default: " DEFAULT_ADISK_NAME ")");
 	puts("    -g, --debug               Generate debug information");
+	puts("        --compress-symbols    Compress source files in debug information");
 	puts("    -G, --game <id>           Specify game ID");
 	puts("    -Es, --encoding=sjis      Set input coding system to SJIS");
 	puts("    -Eu, --encoding=utf8      Set input coding system to UTF-8 (default)");
 	puts("    -i, --hed <file>          Read compile header (.hed) from <file>");
 	puts("    -h, --help                Display this message and exit");
+	puts("    -I, --incremental         Reuse unchanged pages from the previous build");
+	puts("    -j, --jobs <n>            Compile and write output files using <n> threads");
+	puts("    -O, --optimize            Fold constants, thread jumps and remove unreachable code");
 	puts("    -p, --project <file>      Read project configuration from <file>");
+	puts("        --server              Answer editor queries on stdin/stdout (LSP)");
 	puts("    -u, --unicode             Generate Unicode output (can only be run on system3-sdl2)");
 	puts("    -V, --variables <file>    Read list of variables from <file>");
 	puts("    -v, --version             Print version information and exit");
+	puts("    -w, --watch               Rebuild when input files change (Linux only)");
 }
 
 static void version(void) {
 	puts("sys3c " VERSION);
 }
 
+typedef struct {
+	const char *project;
+	const char *adisk_name;
+	const char *outdir;
+	const char *hed;
+	const char *var_list;
+	int nr_files;
+	char **files;
+} Options;
+
+// In watch mode, the build process reports the files it reads here.
+static FILE *input_log;
+
+static void watch_input(const char *path) {
+	if (!input_log)
+		return;
+	fprintf(input_log, "%s\n", path);
+	fflush(input_log);
+}
+
 static char *next_line(char **buf) {
 	if (!**buf)
 		return NULL;
@@ -79,38 +123,53 @@ static char *next_line(char **buf) {
 	return line;
 }
 
-static char *read_file(const char *path) {
-	FILE *fp = checked_fopen(path, "rb");
-	if (fseek(fp, 0, SEEK_END) != 0)
-		error("%s: %s", path, strerror(errno));
-	long size = ftell(fp);
-	if (size < 0)
-		error("%s: %s", path, strerror(errno));
-	if (fseek(fp, 0, SEEK_SET) != 0)
-		error("%s: %s", path, strerror(errno));
-	char *buf = malloc(size + 2);
-	if (size > 0 && fread(buf, size, 1, fp) != 1)
-		error("%s: read error", path);
-	fclose(fp);
-	buf[size] = '\n';
-	buf[size + 1] = '\0';
+char *try_load_file(const char *path, size_t *psize) {
+	MappedFile *mf;
+	int err = try_map_file(path, &mf);
+	if (err) {
+		errno = err;
+		return NULL;
+	}
+	char *buf = malloc(mf->size + 2);
+	memcpy(buf, mf->data, mf->size);
+	buf[mf->size] = '\n';
+	buf[mf->size + 1] = '\0';
+	if (psize)
+		*psize = mf->size;
+	unmap_file(mf);
+	return buf;
+}
 
+static char *load_file(const char *path, size_t *psize) {
+	char *buf = try_load_file(path, psize);
+	if (!buf)
+		error("cannot open %s: %s", path, strerror(errno));
+	return buf;
+}
+
+char *convert_source(char *buf, const char **invalid) {
 	if (config.utf8) {
-		const char *err = validate_utf8(buf);
-		if (err) {
-			lexer_init(buf, path, -1);
-			error_at(err, "Invalid UTF-8 character");
-		}
+		*invalid = validate_utf8(buf);
 		return buf;
-	} else {
-		char *utf = sjis2utf_sub(buf, 0xfffd);  // U+FFFD REPLACEMENT CHARACTER
-		char *err = strstr(utf, u8"\ufffd");
-		if (err) {
-			lexer_init(utf, path, -1);
-			error_at(err, "Invalid Shift_JIS character");
-		}
-		return sjis2utf(buf);
 	}
+	return sjis2utf_checked(buf, invalid);
+}
+
+static noreturn void invalid_character(const char *source, const char *pos, const char *path) {
+	lexer_init(source, path, -1);
+	error_at(pos, config.utf8 ? "Invalid UTF-8 character" : "Invalid Shift_JIS character");
+}
+
+static char *decode_source(char *buf, const char *path) {
+	const char *invalid;
+	char *source = convert_source(buf, &invalid);
+	if (invalid)
+		invalid_character(source, invalid, path);
+	return source;
+}
+
+static char *read_file(const char *path) {
+	return decode_source(load_file(path, NULL), path);
 }
 
 static char *trim_right(char *str) {
@@ -148,31 +207,210 @@ static void read_hed(const char *path, Vector *sources) {
 		sources->len--;
 }
 
+typedef struct {
+	int volume;
+	char path[PATH_MAX+1];
+	char tmp_path[PATH_MAX+5];
+	uint8_t *image;
+	size_t size;
+	bool unchanged;
+	FILE *fp;
+} OutputVolume;
+
+typedef struct {
+	Vector *dri;
+	int nr_volumes;
+	OutputVolume volumes[DRI_MAX_VOLUME];
+} VolumeWriter;
+
+// Returns true if the file at `path` already has the given content. A file
+// that cannot be read is treated as different, so that it gets rewritten.
+static bool file_has_content(const char *path, const uint8_t *data, size_t size) {
+	MappedFile *mf;
+	if (try_map_file(path, &mf))
+		return false;
+	bool same = mf->size == size && !memcmp(mf->data, data, size);
+	unmap_file(mf);
+	return same;
+}
+
+// Writes `data` to `fp`, opened on `tmp_path`, and renames it to `path`.
+static void commit_file(FILE *fp, const char *tmp_path, const char *path, const void *data, size_t size) {
+	if (fwrite(data, size, 1, fp) != 1 || fclose(fp) != 0)
+		error("%s: %s", tmp_path, strerror(errno));
+	checked_rename(tmp_path, path);
+}
+
+static void build_volume(void *ctx, int i) {
+	OutputVolume *v = &((VolumeWriter *)ctx)->volumes[i];
+	v->image = dri_build_image(((VolumeWriter *)ctx)->dri, v->volume, &v->size);
+	v->unchanged = file_has_content(v->path, v->image, v->size);
+}
+
+static void write_volume(void *ctx, int i) {
+	OutputVolume *v = &((VolumeWriter *)ctx)->volumes[i];
+	if (!v->unchanged)
+		commit_file(v->fp, v->tmp_path, v->path, v->image, v->size);
+	free(v->image);
+}
+
+// Volumes whose content is unchanged are left untouched, to keep their
+// timestamps. Others are written to a temporary file and then renamed.
+static void write_volumes(Vector *dri, uint32_t dri_mask, const char *adisk_name) {
+	VolumeWriter w = { .dri = dri };
+	for (int i = 1; i <= DRI_MAX_VOLUME; i++) {
+		if (!(dri_mask & 1 << i))
+			continue;
+		OutputVolume *v = &w.volumes[w.nr_volumes++];
+		v->volume = i;
+		strncpy(v->path, adisk_name, PATH_MAX);
+		if (i != 1) {
+			char *base = strrchr(v->path, '/');
+			base = base ? base + 1 : v->path;
+			if (!dri_filename(base, i))
+				error("cannot determine output filename");
+		}
+		strcpy(v->tmp_path, v->path);
+		strcat(v->tmp_path, ".tmp");
+	}
+	parallel_for(w.nr_volumes, config.jobs, build_volume, &w);
+
+	// Output files are opened in volume order so that errors are reported in
+	// the same way regardless of the number of jobs.
+	for (int i = 0; i < w.nr_volumes; i++) {
+		OutputVolume *v = &w.volumes[i];
+		if (!v->unchanged)
+			v->fp = checked_fopen(v->tmp_path, "wb");
+	}
+	parallel_for(w.nr_volumes, config.jobs, write_volume, &w);
+}
+
+// Number of pages the loader thread may read ahead of the compiler.
+#define LOAD_AHEAD 8
+
+// A page source. Sources are loaded ahead of compilation, by the loader thread
+// or by the speculative compilation workers. These do not report errors; the
+// main thread loads the file again when it reaches the page, so errors are
+// reported in page order.
+typedef struct {
+	char *raw;    // content of the file, NULL if it could not be read
+	size_t size;
+	uint64_t hash;  // hash of `raw` (incremental builds only)
+	char *source;   // UTF-8 source, NULL if not decoded
+	const char *invalid;  // first invalid character in `source`, if any
+} SourceFile;
+
+typedef struct {
+	Vector *paths;
+	SourceFile *files;
+	BuildCache *cache;
+	Compiler *compiler;
+	bool *compiled;
+} PageLoader;
+
+static void release_source(SourceFile *f) {
+	if (f->source != f->raw)
+		free(f->source);
+	free(f->raw);
+	f->raw = f->source = NULL;
+}
+
+static void load_source(void *ctx, int i) {
+	PageLoader *pl = ctx;
+	const char *path = pl->paths->data[i];
+	SourceFile *f = &pl->files[i];
+	if (!path || !(f->raw = try_load_file(path, &f->size)))
+		return;
+	if (pl->cache) {
+		f->hash = hash_data(f->raw, f->size);
+		// Pages that are likely to be taken from the cache are decoded only
+		// when needed. Debug information contains all sources.
+		if (build_cache_has(pl->cache, i, f->hash) && !config.debug)
+			return;
+	}
+	f->source = convert_source(f->raw, &f->invalid);
+}
+
+static void compile_page_speculatively(void *ctx, int i) {
+	PageLoader *pl = ctx;
+	load_source(ctx, i);
+	SourceFile *f = &pl->files[i];
+	if (f->source && !f->invalid) {
+		pl->compiled[i] = try_compile(pl->compiler, f->source, i) != NULL;
+		if (pl->compiled[i] && !config.debug)
+			release_source(f);
+	}
+}
+
 static void build(Vector *src_paths, Vector *variables, Vector *verbs, Vector *objs, const char *adisk_name) {
-	Map *srcs = new_map();
-	for (int i = 0; i < src_paths->len; i++) {
-		char *path = src_paths->data[i];
-		map_put(srcs, path, path ? read_file(path) : NULL);
+	BuildCache *cache = NULL;
+	char cache_path[PATH_MAX+1];
+	if (config.incremental) {
+		snprintf(cache_path, sizeof(cache_path), "%s.cache", adisk_name);
+		cache = load_build_cache(cache_path, build_fingerprint(src_paths, verbs, objs), src_paths->len);
 	}
 
-	Compiler *compiler = new_compiler(srcs->keys, variables, verbs, objs);
+	Compiler *compiler = new_compiler(src_paths, variables, verbs, objs);
+	compiler->record_symbols = cache != NULL;
 
 	if (config.debug)
-		compiler->dbg_info = new_debug_info(srcs);
+		compiler->dbg_info = new_debug_info();
+
+	PageLoader pl = {
+		.paths = src_paths,
+		.files = calloc(src_paths->len, sizeof(SourceFile)),
+		.cache = cache,
+		.compiler = compiler,
+		.compiled = calloc(src_paths->len, sizeof(bool)),
+	};
+
+	// With multiple jobs, pages are first loaded and compiled concurrently
+	// against the initial symbol table. The pages for which that fails are then
+	// compiled in order, so the result is the same as a serial build.
+	// Otherwise, sources are loaded on a background thread while the preceding
+	// pages are compiled.
+	Pipeline *loader = NULL;
+	if (config.jobs > 1)
+		parallel_for(src_paths->len, config.jobs, compile_page_speculatively, &pl);
+	else
+		loader = pipeline_start(src_paths->len, LOAD_AHEAD, load_source, &pl);
 
 	uint32_t dri_mask = 0;
 	Vector *dri = new_vec();
-	for (int i = 0; i < srcs->keys->len; i++) {
-		const char *source = srcs->vals->data[i];
-		if (!source) {
+	for (int i = 0; i < src_paths->len; i++) {
+		const char *path = src_paths->data[i];
+		if (!path) {
 			vec_push(dri, NULL);
-			if (config.debug) {
-				debug_init_page(compiler->dbg_info, i);
-				debug_finish_page(compiler->dbg_info);
-			}
+			if (config.debug)
+				debug_add_page(compiler->dbg_info, NULL, NULL, NULL);
 			continue;
 		}
-		Sco *sco = compile(compiler, source, i);
+		if (loader)
+			pipeline_wait(loader, i);
+		SourceFile *f = &pl.files[i];
+		if (!pl.compiled[i] && !f->raw) {
+			// The loader could not read the file. Try again to report the error.
+			f->raw = load_file(path, &f->size);
+			f->hash = hash_data(f->raw, f->size);
+			if (config.debug)
+				f->source = decode_source(f->raw, path);
+		}
+		if (f->invalid)
+			invalid_character(f->source, f->invalid, path);
+
+		Sco *sco = pl.compiled[i] ? &compiler->scos[i]
+			: cache ? build_cache_lookup(cache, compiler, i, f->hash) : NULL;
+		if (!sco) {
+			if (!f->source)
+				f->source = decode_source(f->raw, path);
+			sco = compile(compiler, f->source, i);
+		}
+		if (cache)
+			build_cache_store(cache, i, f->hash, sco);
+		if (config.debug)
+			debug_add_page(compiler->dbg_info, path, f->source, sco->linemap);
+		else
+			release_source(f);
 		DriEntry *e = calloc(1, sizeof(DriEntry));
 		e->volume_bits = sco->volume_bits;
 		e->data = sco->buf->buf;
@@ -181,21 +419,10 @@ static void build(Vector *src_paths, Vector *variables, Vector *verbs, Vector *o
 		dri_mask |= e->volume_bits;
 	}
 
-	for (int i = 1; i <= DRI_MAX_VOLUME; i++) {
-		if (!(dri_mask & 1 << i))
-			continue;
-		char dri_path[PATH_MAX+1];
-		strncpy(dri_path, adisk_name, PATH_MAX);
-		if (i != 1) {
-			char *base = strrchr(dri_path, '/');
-			base = base ? base + 1 : dri_path;
-			if (!dri_filename(base, i))
-				error("cannot determine output filename");
-		}
-		FILE *fp = checked_fopen(dri_path, "wb");
-		dri_write(dri, i, fp);
-		fclose(fp);
-	}
+	if (loader)
+		pipeline_finish(loader);
+
+	write_volumes(dri, dri_mask, adisk_name);
 
 	if (verbs) {
 		switch (config.output_encoding) {
@@ -226,28 +453,244 @@ static void build(Vector *src_paths, Vector *variables, Vector *verbs, Vector *o
 	}
 
 	if (config.debug) {
-		char symbols_path[PATH_MAX+1];
+		char symbols_path[PATH_MAX+1], tmp_path[PATH_MAX+5];
 		snprintf(symbols_path, sizeof(symbols_path), "%s.symbols", adisk_name);
-		FILE *fp = checked_fopen(symbols_path, "wb");
-		debug_info_write(compiler->dbg_info, compiler, fp);
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", symbols_path);
+		Buffer *b = new_buf();
+		debug_info_write(compiler->dbg_info, compiler, b);
+		// Leave the file untouched if nothing has changed, as with the volumes.
+		if (!file_has_content(symbols_path, b->buf, b->len))
+			commit_file(checked_fopen(tmp_path, "wb"), tmp_path, symbols_path, b->buf, b->len);
+	}
+
+	if (cache)
+		save_build_cache(cache, cache_path);
+}
+
+typedef struct {
+	Vector *srcs;
+	Vector *vars;
+	Vector *verbs;
+	Vector *objs;
+	const char *var_list;
+	const char *adisk_name;
+} Project;
+
+// Loads the project configuration and the files it refers to. Returns false
+// if no project is specified.
+static bool load_project(const Options *opts, Project *proj) {
+	const char *project = opts->project;
+	const char *adisk_name = opts->adisk_name;
+	const char *outdir = opts->outdir;
+	const char *hed = opts->hed;
+	const char *var_list = opts->var_list;
+
+	if (project) {
+		watch_input(project);
+		FILE *fp = checked_fopen(project, "r");
+		load_config(fp, dirname_utf8(project));
 		fclose(fp);
+	} else if (!hed && opts->nr_files == 0) {
+		watch_input("sys3c.cfg");
+		FILE *fp = fopen("sys3c.cfg", "r");
+		if (fp) {
+			load_config(fp, NULL);
+			fclose(fp);
+		} else {
+			return false;
+		}
+	}
+	if (config.game_id == GAKUEN_MSX) {
+		if (config.output_encoding == UTF8)
+			error("gakuen_msx cannot be compiled with UTF-8 encoding.");
+		config.output_encoding = MSX;
+	}
+	if (!hed && config.hed)
+		hed = config.hed;
+	if (!var_list && config.var_list)
+		var_list = config.var_list;
+	if (!adisk_name) {
+		adisk_name = config.adisk_name ? config.adisk_name
+			: project ? path_join(dirname_utf8(project), DEFAULT_ADISK_NAME)
+			: DEFAULT_ADISK_NAME;
+	}
+	if (!outdir && config.outdir)
+		outdir = config.outdir;
+	if (outdir) {
+		if (make_dir(outdir) != 0 && errno != EEXIST)
+			error("cannot create directory %s: %s", outdir, strerror(errno));
+		// If outdir is specified, the directory part of adisk_name is ignored
+		adisk_name = path_join(outdir, basename_utf8(adisk_name));
+	}
+
+	Vector *srcs = new_vec();
+	if (hed) {
+		watch_input(hed);
+		read_hed(hed, srcs);
+	}
+
+	for (int i = 0; i < opts->nr_files; i++)
+		vec_push(srcs, opts->files[i]);
+	for (int i = 0; i < srcs->len; i++) {
+		if (srcs->data[i])
+			watch_input(srcs->data[i]);
+	}
+
+	if (srcs->len == 0)
+		error("sys3c: No source file specified.");
+
+	if (var_list)
+		watch_input(var_list);
+	if (config.verb_list)
+		watch_input(config.verb_list);
+	if (config.obj_list)
+		watch_input(config.obj_list);
+
+	Vector *vars = var_list ? read_txt(var_list, true) : NULL;
+	Vector *verbs = config.verb_list ? read_txt(config.verb_list, false) : NULL;
+	if (verbs && verbs->len > 256)
+		error("Too many verbs");
+	Vector *objs = config.obj_list ? read_txt(config.obj_list, false) : NULL;
+	if (objs && objs->len > 256)
+		error("Too many objects");
+
+	*proj = (Project){ srcs, vars, verbs, objs, var_list, adisk_name };
+	return true;
+}
+
+static int compile_project(const Options *opts) {
+	Project proj;
+	if (!load_project(opts, &proj)) {
+		usage();
+		return 1;
+	}
+	build(proj.srcs, proj.vars, proj.verbs, proj.objs, proj.adisk_name);
+	return 0;
+}
+
+#ifdef __linux__
+
+#define WATCH_DEBOUNCE_MS 50
+
+static int elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+// Runs compile_project() in a child process, since errors terminate the
+// process. Returns the list of files the build has read.
+static Vector *build_once(const Options *opts, int inotify_fd) {
+	fflush(stdout);
+	fflush(stderr);
+	int pipefd[2];
+	if (pipe(pipefd) < 0)
+		error("pipe: %s", strerror(errno));
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid_t pid = fork();
+	if (pid < 0)
+		error("fork: %s", strerror(errno));
+	if (pid == 0) {
+		close(inotify_fd);
+		close(pipefd[0]);
+		input_log = fdopen(pipefd[1], "w");
+		exit(compile_project(opts));
 	}
+	close(pipefd[1]);
+
+	Vector *inputs = new_vec();
+	FILE *fp = fdopen(pipefd[0], "r");
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &size, fp)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		vec_push(inputs, strdup(line));
+	}
+	free(line);
+	fclose(fp);
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			error("waitpid: %s", strerror(errno));
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		printf("sys3c: build finished in %d ms\n", elapsed_ms(&start));
+	else
+		printf("sys3c: build failed\n");
+	return inputs;
 }
 
+static void wait_for_change(int fd, Vector *inputs) {
+	int *wds = calloc(inputs->len, sizeof(int));
+	for (int i = 0; i < inputs->len; i++) {
+		// Watch the directory, so that files replaced by editors are noticed.
+		wds[i] = inotify_add_watch(fd, dirname_utf8(inputs->data[i]),
+								   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+		if (wds[i] < 0)
+			fprintf(stderr, "sys3c: cannot watch %s: %s\n", (char *)inputs->data[i], strerror(errno));
+	}
+	printf("sys3c: watching %d files for changes\n", inputs->len);
+	fflush(stdout);
+
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (bool changed = false; !changed;) {
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			error("inotify: %s", strerror(errno));
+		}
+		for (char *p = buf; p < buf + len;) {
+			struct inotify_event *ev = (struct inotify_event *)p;
+			p += sizeof(struct inotify_event) + ev->len;
+			for (int i = 0; ev->len && i < inputs->len; i++) {
+				if (wds[i] == ev->wd && !strcmp(ev->name, basename_utf8(inputs->data[i])))
+					changed = true;
+			}
+		}
+	}
+	free(wds);
+
+	// A save often consists of several events; let them settle.
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	while (poll(&pfd, 1, WATCH_DEBOUNCE_MS) > 0) {
+		if (read(fd, buf, sizeof(buf)) < 0 && errno != EINTR)
+			error("inotify: %s", strerror(errno));
+	}
+}
+
+static int watch_project(const Options *opts) {
+	int fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0)
+		error("inotify_init1: %s", strerror(errno));
+	for (;;) {
+		Vector *inputs = build_once(opts, fd);
+		if (inputs->len == 0)
+			return 1;
+		wait_for_change(fd, inputs);
+		printf("sys3c: change detected, rebuilding\n");
+	}
+}
+
+#endif // __linux__
+
 int main(int argc, char *argv[]) {
 	init(&argc, &argv);
 
-	const char *project = NULL;
-	const char *adisk_name = NULL;
-	const char *outdir = NULL;
-	const char *hed = NULL;
-	const char *var_list = NULL;
+	Options opts = {0};
+	bool watch = false;
+	bool server = false;
 
 	int opt;
 	while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'd':
-			outdir = optarg;
+			opts.outdir = optarg;
 			break;
 		case 'E':
 			switch (optarg[0]) {
@@ -269,86 +712,68 @@ int main(int argc, char *argv[]) {
 			usage();
 			return 0;
 		case 'i':
-			hed = optarg;
+			opts.hed = optarg;
+			break;
+		case 'I':
+			config.incremental = true;
+			break;
+		case 'j':
+			config.jobs = atoi(optarg);
+			if (config.jobs <= 0)
+				error("Invalid number of jobs '%s'", optarg);
+			break;
+		case 'O':
+			config.optimize = true;
 			break;
 		case 'o':
-			adisk_name = optarg;
+			opts.adisk_name = optarg;
 			break;
 		case 'p':
-			project = optarg;
+			opts.project = optarg;
 			break;
 		case 'u':
 			config.output_encoding = UTF8;
 			break;
 		case 'V':
-			var_list = optarg;
+			opts.var_list = optarg;
 			break;
 		case 'v':
 			version();
 			return 0;
+		case 'w':
+			watch = true;
+			break;
+		case OPT_SERVER:
+			server = true;
+			break;
+		case OPT_COMPRESS_SYMBOLS:
+			config.compress_symbols = true;
+			break;
 		case '?':
 			usage();
 			return 1;
 		}
 	}
-	argc -= optind;
-	argv += optind;
+	opts.files = argv + optind;
+	opts.nr_files = argc - optind;
 
-	if (project) {
-		FILE *fp = checked_fopen(project, "r");
-		load_config(fp, dirname_utf8(project));
-		fclose(fp);
-	} else if (!hed && argc == 0) {
-		FILE *fp = fopen("sys3c.cfg", "r");
-		if (fp) {
-			load_config(fp, NULL);
-			fclose(fp);
-		} else {
+	if (server) {
+		Project proj;
+		if (!load_project(&opts, &proj)) {
 			usage();
 			return 1;
 		}
+		return run_server(proj.srcs, proj.vars, proj.var_list, proj.verbs, proj.objs);
 	}
-	if (config.game_id == GAKUEN_MSX) {
-		if (config.output_encoding == UTF8)
-			error("gakuen_msx cannot be compiled with UTF-8 encoding.");
-		config.output_encoding = MSX;
-	}
-	if (!hed && config.hed)
-		hed = config.hed;
-	if (!var_list && config.var_list)
-		var_list = config.var_list;
-	if (!adisk_name) {
-		adisk_name = config.adisk_name ? config.adisk_name
-			: project ? path_join(dirname_utf8(project), DEFAULT_ADISK_NAME)
-			: DEFAULT_ADISK_NAME;
-	}
-	if (!outdir && config.outdir)
-		outdir = config.outdir;
-	if (outdir) {
-		if (make_dir(outdir) != 0 && errno != EEXIST)
-			error("cannot create directory %s: %s", outdir, strerror(errno));
-		// If outdir is specified, the directory part of adisk_name is ignored
-		adisk_name = path_join(outdir, basename_utf8(adisk_name));
+	if (watch) {
+#ifdef __linux__
+		// Each build reuses the results of the previous one.
+		config.incremental = true;
+		return watch_project(&opts);
+#else
+		error("--watch is not supported on this platform");
+#endif
 	}
-
-	Vector *srcs = new_vec();
-	if (hed)
-		read_hed(hed, srcs);
-
-	for (int i = 0; i < argc; i++)
-		vec_push(srcs, argv[i]);
-
-	if (srcs->len == 0)
-		error("sys3c: No source file specified.");
-
-	Vector *vars = var_list ? read_txt(var_list, true) : NULL;
-	Vector *verbs = config.verb_list ? read_txt(config.verb_list, false) : NULL;
-	if (verbs && verbs->len > 256)
-		error("Too many verbs");
-	Vector *objs = config.obj_list ? read_txt(config.obj_list, false) : NULL;
-	if (objs && objs->len > 256)
-		error("Too many objects");
-
-	build(srcs, vars, verbs, objs, adisk_name);
-	return 0;
+	return compile_project(&opts);
 }
+
@@ -16,6 +16,7 @@
  *
 */
 #include "common.h"
+#include <setjmp.h>
 
 // config.c
 
@@ -33,6 +34,10 @@ typedef struct {
 	int ag00_uk1, ag00_uk2;
 
 	bool debug;
+	bool compress_symbols;
+	bool optimize;
+	bool incremental;
+	int jobs;
 	enum encoding output_encoding;
 	bool utf8;
 	bool allow_ascii;
@@ -52,7 +57,12 @@ typedef struct {
 } Buffer;
 
 Buffer *new_buf(void);
+Buffer *new_buf_sized(int size);
 void emit(Buffer *b, uint8_t c);
+void emit_bytes(Buffer *b, const void *data, int len);
+// Makes room for `len` more bytes and returns a pointer to them. The caller
+// writes to it directly and adds the number of bytes written to b->len.
+uint8_t *reserve_bytes(Buffer *b, int len);
 void emit_word(Buffer *b, uint16_t v);
 void emit_word_be(Buffer *b, uint16_t v);
 void emit_dword(Buffer *b, uint32_t v);
@@ -68,11 +78,21 @@ int current_address(Buffer *b);
 
 // lexer.c
 
-extern const char *input_name;
-extern int input_page;
-extern const char *input_buf;
-extern const char *input;
-extern int input_line;
+extern _Thread_local const char *input_name;
+extern _Thread_local int input_page;
+extern _Thread_local const char *input_buf;
+extern _Thread_local const char *input;
+extern _Thread_local int input_line;
+// Set while a page is compiled by try_compile(). Instead of reporting
+// diagnostics, the compilation is abandoned by longjmp()ing here.
+extern _Thread_local jmp_buf *speculation;
+// Memory for objects that are discarded when the current page has been
+// compiled.
+extern _Thread_local Arena *page_arena;
+// Interner for the strings returned by get_identifier() etc. Its parent is
+// Compiler.atoms, so names in the symbol table are returned as the same atoms
+// as in the table, unless the page used the name before it was defined.
+extern _Thread_local Interner *page_atoms;
 
 enum {
 	STRING_COMPACT = 1 << 0,
@@ -80,8 +100,21 @@ enum {
 	STRING_ESCAPE_SQUOTE = 1 << 2,
 };
 
-#define error_at(...) (warn_at(__VA_ARGS__), exit(1))
+// A diagnostic collected in `diagnostics`.
+typedef struct {
+	int offset;  // position in the source
+	bool error;  // false for warnings
+	char *message;
+} Diagnostic;
+
+// If set, diagnostics are appended here (as malloc()ed Diagnostics) instead of
+// being printed.
+extern _Thread_local Vector *diagnostics;
+// If set, error_at() longjmp()s here instead of exiting.
+extern _Thread_local jmp_buf *error_recovery;
+
 void warn_at(const char *pos, char *fmt, ...);
+noreturn void error_at(const char *pos, char *fmt, ...);
 void lexer_init(const char *source, const char *name, int pageno);
 void skip_whitespaces(void);
 char next_char(void);
@@ -89,10 +122,10 @@ bool consume(char c);
 void expect(char c);
 bool consume_keyword(const char *keyword);
 uint8_t echo(Buffer *b);
-char *get_identifier(void);
-char *get_label(void);
-char *get_filename(void);
-char *get_string(void);
+const char *get_identifier(void);
+const char *get_label(void);
+const char *get_filename(void);
+const char *get_string(void);
 int get_number(void);
 void compile_string(Buffer *b, char terminator, unsigned flags);
 void compile_message(Buffer *b);
@@ -101,9 +134,49 @@ int get_command(Buffer *b);
 
 // compile.c
 
+typedef enum {
+	VARIABLE,
+	CONST,
+} SymbolType;
+
+typedef struct {
+	SymbolType type;
+	int value;  // variable index or constant value
+} Symbol;
+
+// A symbol table access made while compiling a page. Only the first lookup of
+// each name is recorded.
+typedef struct {
+	const char *name;
+	bool define;  // defined by the page (otherwise looked up)
+	int type;     // SymbolType, or -1 if the symbol was not found
+	int value;
+} SymbolAccess;
+
+typedef enum {
+	REF_LABEL,
+	REF_SYMBOL,  // variable or constant
+	REF_PAGE,    // '#' operator
+} ReferenceKind;
+
+// An occurrence of a name in a page, recorded for the query server.
+typedef struct {
+	ReferenceKind kind;
+	bool define;       // the label or symbol is defined here
+	const char *name;  // label, symbol or file name
+	int page;          // REF_PAGE: the page the file name refers to
+	int offset;        // position in the source
+	int length;
+} Reference;
+
 typedef struct {
 	Buffer *buf;
 	uint32_t volume_bits;
+	struct LineMap *linemap;  // debug line information, NULL if not generated
+	Vector *symbol_accesses;  // SymbolAccess*, NULL unless record_symbols
+	Vector *references;  // Reference*, NULL unless record_references
+	Arena *arena;  // owns symbol_accesses and references
+	bool no_default_label;
 } Sco;
 
 struct DebugInfo;
@@ -111,16 +184,24 @@ struct DebugInfo;
 typedef struct {
 	Vector *src_paths;
 	Vector *variables;
-	HashMap *symbols;   // variables and constants
+	HashMap *symbols;   // variables and constants, keyed by atoms in `atoms`
 	Vector *verb_list;
 	HashMap *verb_map;
 	Vector *obj_list;
 	HashMap *obj_map;
 	Sco *scos;
 	struct DebugInfo *dbg_info;
+	bool record_symbols;
+	bool record_references;
+	// Symbols, and the atoms for their names and verb/object keys. Only the
+	// main thread adds to these, since try_compile() never modifies the symbol
+	// table.
+	Arena *arena;
+	Interner *atoms;
 } Compiler;
 
 typedef struct {
+	const char *name;
 	uint32_t addr;
 	uint32_t hole_addr;
 	const char *source_loc;
@@ -128,11 +209,104 @@ typedef struct {
 
 Compiler *new_compiler(Vector *src_paths, Vector *variables, Vector *verbs, Vector *objs);
 Sco *compile(Compiler *comp, const char *source, int pageno);
+// Compiles a page without modifying the symbol table, so that multiple pages
+// can be compiled concurrently. Returns NULL if the result might differ from
+// compile() after the preceding pages, e.g. because the page defines a symbol
+// or references one that is not defined yet, or if a diagnostic would be
+// reported. Such pages must be compiled with compile() in page order.
+Sco *try_compile(Compiler *comp, const char *source, int pageno);
+// Compiles a page, appending its diagnostics to `diags` instead of printing
+// them. On error, returns NULL; the symbols defined before the error stay in
+// the symbol table, and the references recorded so far are kept in the Sco.
+Sco *compile_with_diagnostics(Compiler *comp, const char *source, int pageno, Vector *diags);
+// Frees the compiler and its symbol table. The Sco buffers and arenas, and the
+// vectors passed to new_compiler(), are not freed.
+void free_compiler(Compiler *comp);
+// If the recorded accesses give the same results against the current symbol
+// table, applies the definitions in them and returns true.
+bool replay_symbols(Compiler *comp, Vector *accesses);
+
+// optimize.c
+
+typedef enum {
+	CODE_OTHER,
+	CODE_JUMP,       // '@': jumps to the address in the following word
+	CODE_PAGE_JUMP,  // '&'
+	CODE_RETURN,     // '\0:'
+	CODE_BRANCH,     // '{' in System 1 and 2, which is closed by a '}' marker
+	CODE_MARKER,     // '}' or EOF marker
+} CodeKind;
+
+typedef struct {
+	int addr;
+	CodeKind kind;
+} CodeCommand;
+
+// Layout of the code of a page, recorded by the compiler for optimize_page().
+typedef struct {
+	Vector *commands;  // CodeCommand*, in address order
+	Vector *slots;     // addresses of the words that hold code addresses
+	bool fixed_entry;  // the default address was given by a pragma
+} CodeMap;
+
+// Redirects jumps to unconditional jumps to their final destination, and
+// removes the commands that cannot be reached. Addresses in `linemap` are
+// updated accordingly.
+void optimize_page(Buffer *b, CodeMap *map, struct LineMap *linemap);
 
 // debuginfo.c
 
-struct DebugInfo *new_debug_info(Map *srcs);
-void debug_init_page(struct DebugInfo *di, int page);
-void debug_line_add(struct DebugInfo *di, int line, int addr);
-void debug_finish_page(struct DebugInfo *di);
-void debug_info_write(struct DebugInfo *di, Compiler *compiler, FILE *fp);
+typedef struct {
+	int line;
+	int addr;
+} LineInfo;
+
+// Line information of a page, in address order.
+typedef struct LineMap {
+	LineInfo *entries;
+	int len;
+	int cap;
+} LineMap;
+
+struct DebugInfo *new_debug_info(void);
+LineMap *new_linemap(int cap);
+void free_linemap(LineMap *lm);
+void debug_line_add(LineMap *linemap, int line, int addr);
+// Must be called for each page in page order. path, source and linemap may be
+// NULL for a page without source.
+void debug_add_page(struct DebugInfo *di, const char *path, const char *source, LineMap *linemap);
+void debug_info_write(struct DebugInfo *di, Compiler *compiler, Buffer *out);
+
+// sys3c.c
+
+// Reads the whole file, appending "\n\0". If psize is not NULL, the size of
+// the file is stored in it. Returns NULL and sets errno on failure.
+char *try_load_file(const char *path, size_t *psize);
+// Converts the content of a file read by try_load_file() to UTF-8. If it
+// contains an invalid character, its position in the result is stored in
+// *invalid. The result may be `buf` itself.
+char *convert_source(char *buf, const char **invalid);
+
+// server.c
+
+// Runs the query server until the client exits. Returns the exit status.
+int run_server(Vector *src_paths, Vector *variables, const char *var_list, Vector *verbs, Vector *objs);
+
+// cache.c
+
+typedef struct BuildCache BuildCache;
+
+uint64_t hash_data(const void *data, size_t len);
+// Returns the fingerprint of everything other than the page sources and the
+// symbol table that affects the compiled code.
+uint64_t build_fingerprint(Vector *src_paths, Vector *verbs, Vector *objs);
+// Loads the cache file at `path`. Returns an empty cache if the file does not
+// exist, is broken, or was made with a different fingerprint.
+BuildCache *load_build_cache(const char *path, uint64_t fingerprint, int nr_pages);
+// Returns true if the cache has an entry for the page with the given source.
+bool build_cache_has(BuildCache *cache, int page, uint64_t source_hash);
+// Returns the cached result of the page if its source is unchanged and the
+// symbols it uses have not changed, replaying its symbol definitions.
+Sco *build_cache_lookup(BuildCache *cache, Compiler *comp, int page, uint64_t source_hash);
+void build_cache_store(BuildCache *cache, int page, uint64_t source_hash, Sco *sco);
+void save_build_cache(BuildCache *cache, const char *path);
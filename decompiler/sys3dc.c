@@ -214,14 +214,16 @@ int main(int argc, char *argv[]) {
 			ag00 = ag00_read(argv[i]);
 			continue;
 		}
-		scos = dri_read(scos, argv[i]);
+		MappedFile *mf = map_file(argv[i]);
+		scos = dri_read_mapped(scos, argv[i], mf);
+		size_t header_len = mf->size < 256 ? mf->size : 256;
 		switch (dri_volume_number(basename)) {
 		case 1:
 			adisk_name = basename;
-			adisk_crc = calc_crc32(argv[i]);
+			adisk_crc = calc_crc32(mf->data, header_len);
 			break;
 		case 2:
-			bdisk_crc = calc_crc32(argv[i]);
+			bdisk_crc = calc_crc32(mf->data, header_len);
 			break;
 		}
 	}
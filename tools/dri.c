@@ -15,13 +15,18 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
 */
+#ifdef __linux__
+#define _GNU_SOURCE  // for copy_file_range()
+#endif
 #include "common.h"
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #ifdef _WIN32
 #include <sys/utime.h>
 #endif
@@ -33,6 +38,7 @@ static void usage(void) {
 	puts("  list     Print list of archive files");
 	puts("  create   Create a new archive");
 	puts("  extract  Extract file(s) from archive");
+	puts("  update   Replace a file in archive");
 	puts("  dump     Print hex dump of file");
 	puts("  compare  Compare contents of two archives");
 	puts("  help     Display help information about commands");
@@ -53,15 +59,17 @@ static bool is_archive_filename(const char *path) {
 	return false;
 }
 
-static Vector *read_dris(int *pargc, char **pargv[]) {
+// If index_only is true, entry data must be accessed through dri_entry_data().
+static Vector *read_dris(int *pargc, char **pargv[], bool index_only) {
 	int argc = *pargc;
 	char **argv = *pargv;
+	Vector *(*reader)(Vector *, const char *) = index_only ? dri_read_index : dri_read;
 
 	for (int dd = 0; dd < argc; dd++) {
 		if (!strcmp(argv[dd], "--")) {
 			Vector *dri = NULL;
 			for (int i = 0; i < dd; i++)
-				dri = dri_read(dri, argv[i]);
+				dri = reader(dri, argv[i]);
 			*pargc -= dd + 1;
 			*pargv += dd + 1;
 			return dri;
@@ -72,7 +80,7 @@ static Vector *read_dris(int *pargc, char **pargv[]) {
 	for (int i = 0; i < argc; i++) {
 		if (!is_archive_filename(argv[i]))
 			break;
-		dri = dri_read(dri, argv[i]);
+		dri = reader(dri, argv[i]);
 		*pargc -= 1;
 		*pargv += 1;
 	}
@@ -123,7 +131,7 @@ static int do_list(int argc, char *argv[]) {
 	}
 	Vector *dri = new_vec();
 	for (int i = 1; i < argc; i++)
-		dri_read(dri, argv[i]);
+		dri_read_index(dri, argv[i]);
 	for (int i = 0; i < dri->len; i++) {
 		DriEntry *e = dri->data[i];
 		if (!e)
@@ -153,26 +161,35 @@ static void help_create(void) {
 	puts("    -m, --manifest <file>    Read manifest from <file>");
 }
 
-static void add_file(Vector *dri, uint32_t volume_bits, int no, const char *path) {
-	FILE *fp = checked_fopen(path, "rb");
-	struct stat sbuf;
-	if (fstat(fileno(fp), &sbuf) < 0)
-		error("%s: %s", path, strerror(errno));
-	uint8_t *data = malloc(sbuf.st_size);
-	if (!data)
-		error("out of memory");
-	if (sbuf.st_size > 0 && fread(data, sbuf.st_size, 1, fp) != 1)
-		error("%s: %s", path, strerror(errno));
-	fclose(fp);
+typedef struct {
+	DriEntry *entry;
+	const char *path;
+} InputFile;
 
+static void add_file(Vector *dri, Vector *inputs, uint32_t volume_bits, int no, const char *path) {
 	DriEntry *e = calloc(1, sizeof(DriEntry));
-	e->data = data;
-	e->size = sbuf.st_size;
+	e->id = no;
 	e->volume_bits = volume_bits;
 	vec_set(dri, no - 1, e);
+
+	InputFile *in = calloc(1, sizeof(InputFile));
+	in->entry = e;
+	in->path = strdup(path);
+	vec_push(inputs, in);
+}
+
+static void load_file(void *ctx, int i) {
+	InputFile *in = ((Vector *)ctx)->data[i];
+	MappedFile *mf = map_file(in->path);
+	in->entry->data = mf->data;
+	in->entry->size = mf->size;
+}
+
+static void load_files(Vector *inputs) {
+	parallel_for(inputs->len, nr_cpus(), load_file, inputs);
 }
 
-static uint32_t add_files_from_manifest(Vector *dri, const char *manifest) {
+static uint32_t add_files_from_manifest(Vector *dri, Vector *inputs, const char *manifest) {
 	FILE *fp = checked_fopen(manifest, "r");
 	char line[200];
 	int lineno = 0;
@@ -198,7 +215,7 @@ static uint32_t add_files_from_manifest(Vector *dri, const char *manifest) {
 		if (link_no - 1 < dri->len && dri->data[link_no - 1])
 			error("%s:%d duplicated link number %d", manifest, lineno, link_no);
 		all_volumes |= volume_bits;
-		add_file(dri, volume_bits, link_no, fname);
+		add_file(dri, inputs, volume_bits, link_no, fname);
 	}
 	fclose(fp);
 	return all_volumes;
@@ -226,12 +243,14 @@ static int do_create(int argc, char *argv[]) {
 	}
 	char *dri_path = strdup(argv[0]);
 	Vector *entries = new_vec();
+	Vector *inputs = new_vec();
 
 	if (manifest) {
 		char *dirname = dirname_utf8(dri_path);
 		char *basename = basename_utf8(dri_path);
 
-		uint32_t vol_bits = add_files_from_manifest(entries, manifest);
+		uint32_t vol_bits = add_files_from_manifest(entries, inputs, manifest);
+		load_files(inputs);
 		for (int vol = 1; vol <= DRI_MAX_VOLUME; vol++) {
 			if ((vol_bits & 1 << vol) == 0)
 				continue;
@@ -244,7 +263,8 @@ static int do_create(int argc, char *argv[]) {
 		}
 	} else {
 		for (int i = 1; i < argc; i++)
-			add_file(entries, 1 << 1, i, argv[i]);
+			add_file(entries, inputs, 1 << 1, i, argv[i]);
+		load_files(inputs);
 		FILE *fp = checked_fopen(dri_path, "wb");
 		dri_write(entries, 1, fp);
 		fclose(fp);
@@ -268,14 +288,61 @@ static void help_extract(void) {
 	puts("    -m, --manifest <file>    Write manifest to <file>");
 }
 
-static void extract_entry(DriEntry *e, const char *directory) {
+typedef struct {
+	Vector *entries;
+	const char *directory;
+} ExtractJob;
+
+#ifdef __linux__
+// Copies entry data from the archive file without going through user space.
+// Returns the number of bytes copied, which may be short at the end of file.
+static int copy_from_archive(DriEntry *e, int out_fd) {
+	int in_fd = open(e->path, O_RDONLY);
+	if (in_fd < 0)
+		return 0;
+	off_t offset = e->offset;
+	int copied = 0;
+	while (copied < e->size) {
+		ssize_t n = copy_file_range(in_fd, &offset, out_fd, NULL, e->size - copied, 0);
+		if (n <= 0)
+			break;
+		copied += n;
+	}
+	close(in_fd);
+	return copied;
+}
+#endif
+
+// Writes the entry to "<id>.out".
+static void extract_entry(void *ctx, int i) {
+	ExtractJob *job = ctx;
+	DriEntry *e = job->entries->data[i];
 	char name[20];
 	sprintf(name, "%d.out", e->id);
-	puts(name);
-	FILE *fp = checked_fopen(path_join(directory, name), "wb");
-	if (e->size > 0 && fwrite(e->data, e->size, 1, fp) != 1)
+	FILE *fp = checked_fopen(path_join(job->directory, name), "wb");
+	int copied = 0;
+#ifdef __linux__
+	copied = copy_from_archive(e, fileno(fp));
+#endif
+	if (copied < e->size) {
+		// Write the rest, including zero padding past the end of the archive.
+		const uint8_t *data = dri_entry_data(e);
+		if (fwrite(data + copied, e->size - copied, 1, fp) != 1)
+			error("%s: %s", name, strerror(errno));
+	}
+	if (fclose(fp) != 0)
 		error("%s: %s", name, strerror(errno));
-	fclose(fp);
+}
+
+// Any failure exits, so once parallel_for() returns every entry has been
+// written. The names are printed afterwards to keep them in index order.
+static void extract_entries(Vector *entries, const char *directory) {
+	ExtractJob job = { entries, directory };
+	parallel_for(entries->len, nr_cpus(), extract_entry, &job);
+	for (int i = 0; i < entries->len; i++) {
+		DriEntry *e = entries->data[i];
+		printf("%d.out\n", e->id);
+	}
 }
 
 static int do_extract(int argc, char *argv[]) {
@@ -298,7 +365,9 @@ static int do_extract(int argc, char *argv[]) {
 	argc -= optind;
 	argv += optind;
 
-	Vector *dri = read_dris(&argc, &argv);
+	// Read the whole archive, so that entries duplicated in several volumes
+	// are checked to have the same content.
+	Vector *dri = read_dris(&argc, &argv, false);
 	if (!dri) {
 		help_extract();
 		return 1;
@@ -313,20 +382,50 @@ static int do_extract(int argc, char *argv[]) {
 		fclose(fp);
 	}
 
+	Vector *entries = new_vec();
 	if (!argc) {
 		// Extract all files.
 		for (int i = 0; i < dri->len; i++) {
 			DriEntry *e = dri->data[i];
 			if (e)
-				extract_entry(e, directory);
+				vec_push(entries, e);
 		}
 	} else {
+		bool *selected = calloc(dri->len, sizeof(bool));
 		for (int i = 0; i < argc; i++) {
 			DriEntry *e = find_entry(dri, argv[i]);
-			if (e)
-				extract_entry(e, directory);
+			if (e && !selected[e->id - 1]) {
+				selected[e->id - 1] = true;
+				vec_push(entries, e);
+			}
 		}
+		free(selected);
+	}
+	extract_entries(entries, directory);
+	return 0;
+}
+
+// dri update ----------------------------------------
+
+static void help_update(void) {
+	puts("Usage: dri update <drifile> <n> <file>");
+}
+
+static int do_update(int argc, char *argv[]) {
+	if (argc != 4) {
+		help_update();
+		return 1;
 	}
+	const char *drifile = argv[1];
+	char *endptr;
+	unsigned long idx = strtoul(argv[2], &endptr, 0);
+	if (*endptr != '\0' || idx == 0 || idx > 65535) {
+		fprintf(stderr, "dri: invalid index '%s'\n", argv[2]);
+		return 1;
+	}
+	MappedFile *mf = map_file(argv[3]);
+	dri_update_entry(drifile, idx, mf->data, mf->size);
+	unmap_file(mf);
 	return 0;
 }
 
@@ -384,7 +483,7 @@ static void dump_entry(DriEntry *entry) {
 static int do_dump(int argc, char *argv[]) {
 	argc--;
 	argv++;
-	Vector *dri = read_dris(&argc, &argv);
+	Vector *dri = read_dris(&argc, &argv, true);
 	if (!dri || argc != 1) {
 		help_dump();
 		return 1;
@@ -393,6 +492,7 @@ static int do_dump(int argc, char *argv[]) {
 	DriEntry *e = find_entry(dri, argv[0]);
 	if (!e)
 		return 1;
+	dri_entry_data(e);
 	dump_entry(e);
 	return 0;
 }
@@ -403,17 +503,35 @@ static void help_compare(void) {
 	puts("Usage: dri compare <drifile1> <drifile2>");
 }
 
-static bool compare_entry(int page, DriEntry *e1, DriEntry *e2) {
-	if (e1->size == e2->size && !memcmp(e1->data, e2->data, e1->size))
-		return false;
+typedef struct {
+	Vector *dri1;
+	Vector *dri2;
+	bool *differs;
+} CompareJob;
+
+static void compare_page(void *ctx, int i) {
+	CompareJob *job = ctx;
+	DriEntry *e1 = job->dri1->data[i];
+	DriEntry *e2 = job->dri2->data[i];
+	if (e1 && e2)
+		job->differs[i] = e1->size != e2->size || memcmp(e1->data, e2->data, e1->size);
+}
 
-	int i;
-	for (i = 0; i < e1->size && i < e2->size; i++) {
-		if (e1->data[i] != e2->data[i])
-			break;
+// Prints all ranges of differing bytes in a page.
+static void print_differences(int page, DriEntry *e1, DriEntry *e2) {
+	int common_size = e1->size < e2->size ? e1->size : e2->size;
+	int max_size = e1->size > e2->size ? e1->size : e2->size;
+	for (int i = 0; i < max_size; i++) {
+		if (i < common_size && e1->data[i] == e2->data[i])
+			continue;
+		int start = i;
+		while (i + 1 < max_size && (i + 1 >= common_size || e1->data[i + 1] != e2->data[i + 1]))
+			i++;
+		if (start == i)
+			printf("page %d: differ at %05x\n", page, start);
+		else
+			printf("page %d: differ at %05x-%05x\n", page, start, i);
 	}
-	printf("page %d: differ at %05x\n", page, i);
-	return true;
 }
 
 static bool compare_ag00(const char *file1, const char *file2) {
@@ -467,13 +585,23 @@ static int do_compare(int argc, char *argv[]) {
 		return compare_ag00(drifile1, drifile2);
 	}
 
-	Vector *dri1 = dri_read(NULL, drifile1);
-	Vector *dri2 = dri_read(NULL, drifile2);
+	MappedFile *mf1 = map_file(drifile1);
+	MappedFile *mf2 = map_file(drifile2);
+	Vector *dri1 = dri_read_mapped(NULL, drifile1, mf1);
+	Vector *dri2 = dri_read_mapped(NULL, drifile2, mf2);
+
+	// Compare pages in parallel, then report the differences in page order.
+	int nr_pages = dri1->len < dri2->len ? dri1->len : dri2->len;
+	CompareJob job = { dri1, dri2, calloc(nr_pages + 1, sizeof(bool)) };
+	parallel_for(nr_pages, nr_cpus(), compare_page, &job);
 
 	bool differs = false;
-	for (int i = 0; i < dri1->len && i < dri2->len; i++) {
+	for (int i = 0; i < nr_pages; i++) {
 		if (dri1->data[i] && dri2->data[i]) {
-			differs |= compare_entry(i + 1, dri1->data[i], dri2->data[i]);
+			if (job.differs[i]) {
+				print_differences(i + 1, dri1->data[i], dri2->data[i]);
+				differs = true;
+			}
 		} else if (dri1->data[i]) {
 			printf("page %d only exists in %s\n", i + 1, drifile1);
 			differs = true;
@@ -494,8 +622,8 @@ static int do_compare(int argc, char *argv[]) {
 
 	if (!differs) {
 		// Make sure the CRC32 of the first 256 bytes are the same.
-		uint32_t crc1 = calc_crc32(drifile1);
-		uint32_t crc2 = calc_crc32(drifile2);
+		uint32_t crc1 = calc_crc32(mf1->data, mf1->size < 256 ? mf1->size : 256);
+		uint32_t crc2 = calc_crc32(mf2->data, mf2->size < 256 ? mf2->size : 256);
 		if (crc1 != crc2) {
 			printf("CRC32 of the first 256 bytes differ: %08x vs %08x\n", crc1, crc2);
 			differs = true;
@@ -536,6 +664,7 @@ static Command commands[] = {
 	{"list",    do_list,    help_list},
 	{"create",  do_create,  help_create},
 	{"extract", do_extract, help_extract},
+	{"update",  do_update,  help_update},
 	{"dump",    do_dump,    help_dump},
 	{"compare", do_compare, help_compare},
 	{"help",    do_help,    help_help},